@@ -0,0 +1,173 @@
+/* request handler: each request builds a tree in its own arena and releases it when done.
+ * The tree's nodes point to long-lived sessions and to fresh payloads that
+ * only the arena references, so collections that happen while a request is
+ * in flight must scan the arena to keep them alive.  A few requests are in
+ * flight at once and the oldest is released first, so chunks are released
+ * while others are still being filled, and with SAFEGC_CONCURRENT=1 while a
+ * cycle is marking.  Every tree is checked before its arena is released.
+ * One request in ABANDON_EVERY drops its tree without releasing the arena
+ * and hands the arena on to the next request in its slot, so the sweep has
+ * to free the unreachable chunks and the arena must start over after it.
+ */
+#include "bench.h"
+
+#define NUM_SESSIONS 4096
+#define IN_FLIGHT 4
+#define ABANDON_EVERY 16
+
+struct session
+{
+	long id;
+	long requests;
+	char name[32];
+};
+
+struct node
+{
+	struct node *left;
+	struct node *right;
+	struct session *session;
+	unsigned char *payload;
+	long size;
+	long value;
+};
+
+static struct session **Sessions;
+static gc_arena *Arenas[IN_FLIGHT];
+static struct node *Trees[IN_FLIGHT];
+
+static void *arenaAlloc(gc_arena *arena, size_t size)
+{
+	return benchCount(gc_arena_alloc(arena, size), size);
+}
+
+static struct session *newSession(long id)
+{
+	struct session *s = benchAlloc(sizeof(struct session));
+	s->id = id;
+	s->requests = 0;
+	snprintf(s->name, sizeof(s->name), "session-%ld", id);
+	return s;
+}
+
+static struct node *buildTree(gc_arena *arena, long request, int num_nodes)
+{
+	struct node **nodes = arenaAlloc(arena, sizeof(struct node *) * num_nodes);
+	for (int i = 0; i < num_nodes; i++)
+	{
+		struct node *n = arenaAlloc(arena, sizeof(struct node));
+		n->left = NULL;
+		n->right = NULL;
+		n->session = Sessions[(request * 31 + i) % NUM_SESSIONS];
+		n->session->requests++;
+		n->value = request * num_nodes + i;
+		n->size = 16 + n->value % 240;
+		n->payload = benchAlloc(n->size);
+		memset(n->payload, (int)(n->value & 0xff), n->size);
+		nodes[i] = n;
+		if (i > 0)
+		{
+			struct node *parent = nodes[(i - 1) / 2];
+			if (i % 2)
+			{
+				parent->left = n;
+			}
+			else
+			{
+				parent->right = n;
+			}
+		}
+	}
+	return nodes[0];
+}
+
+/* returns the number of nodes, or -1 if one of them was corrupted */
+static long checkTree(struct node *n)
+{
+	if (n == NULL)
+	{
+		return 0;
+	}
+	if (n->session->name[0] != 's' || n->payload[0] != (unsigned char)n->value ||
+		n->payload[n->size - 1] != (unsigned char)n->value)
+	{
+		return -1;
+	}
+	long left = checkTree(n->left);
+	long right = checkTree(n->right);
+	if (left < 0 || right < 0)
+	{
+		return -1;
+	}
+	return left + right + 1;
+}
+
+static void finishRequest(int slot, long request)
+{
+	int num_nodes = 64 + request % 512;
+	if (checkTree(Trees[slot]) != num_nodes)
+	{
+		printf("request %ld returned a corrupted tree\n", request);
+		exit(1);
+	}
+	Trees[slot] = NULL;
+	if (request % ABANDON_EVERY != ABANDON_EVERY - 1)
+	{
+		gc_arena_release(Arenas[slot]);
+		Arenas[slot] = NULL;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	long num_requests = 10000;
+	if (argc >= 2)
+	{
+		num_requests = atol(argv[1]);
+	}
+
+	benchBegin();
+	Sessions = benchAlloc(sizeof(struct session *) * NUM_SESSIONS);
+	for (int i = 0; i < NUM_SESSIONS; i++)
+	{
+		Sessions[i] = newSession(i);
+	}
+
+	for (long request = 0; request < num_requests; request++)
+	{
+		int slot = request % IN_FLIGHT;
+		if (Trees[slot] != NULL)
+		{
+			finishRequest(slot, request - IN_FLIGHT);
+		}
+		/* some sessions end; trees still in flight keep the old ones alive */
+		if (request % 8 == 0)
+		{
+			long id = request % NUM_SESSIONS;
+			Sessions[id] = newSession(id);
+		}
+		if (Arenas[slot] == NULL)
+		{
+			Arenas[slot] = gc_arena_create(0);
+		}
+		Trees[slot] = buildTree(Arenas[slot], request, 64 + request % 512);
+	}
+	for (long request = num_requests - IN_FLIGHT; request < num_requests; request++)
+	{
+		if (request >= 0)
+		{
+			finishRequest(request % IN_FLIGHT, request);
+		}
+	}
+	benchCollect();
+	for (int slot = 0; slot < IN_FLIGHT; slot++)
+	{
+		if (Arenas[slot] != NULL)
+		{
+			gc_arena_release(Arenas[slot]);
+		}
+	}
+
+	benchReport("arena");
+	return 0;
+}
@@ -0,0 +1,166 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/* Shared harness for the GC benchmark workloads.
+ * Every workload allocates through benchAlloc() so that collections
+ * triggered inside mymalloc are noticed and their pause recorded, and
+ * finishes with benchReport(), which prints one result record to stdout.
+ *
+ * BENCH_FORMAT=json|csv selects the record format (json by default),
+ * BENCH_HEADER=1 prints the CSV header first, and BENCH_RUN / BENCH_COMMIT
+ * are copied into the record so that results can be compared across runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "../memory.h"
+
+extern long long NumGCTriggered;
+extern long long NumBytesFreed;
+extern long long NumBytesAllocated;
+extern long long GCLastPauseNs;
+
+#define BENCH_MAX_PAUSES 65536
+
+/* the pause log lives in libc memory so the collector does not scan it */
+static long long *BenchPauses = NULL;
+static int BenchNumPauses = 0;
+static long long BenchSeenGC = 0;
+static long long BenchNumAllocs = 0;
+static long long BenchStartNs = 0;
+/* workloads that also allocate outside the collector count every byte here;
+ * while it is negative the collector's own count is reported
+ */
+static long long BenchBytesAllocated = -1;
+
+static long long benchTimeNs()
+{
+	struct timespec Ts;
+	clock_gettime(CLOCK_MONOTONIC, &Ts);
+	return (long long)Ts.tv_sec * 1000000000LL + Ts.tv_nsec;
+}
+
+static void benchBegin()
+{
+	BenchPauses = (long long *)malloc(sizeof(long long) * BENCH_MAX_PAUSES);
+	if (BenchPauses == NULL)
+	{
+		printf("unable to allocate pause log\n");
+		exit(0);
+	}
+	BenchSeenGC = NumGCTriggered;
+	BenchStartNs = benchTimeNs();
+}
+
+static void benchRecordPause()
+{
+	BenchSeenGC = NumGCTriggered;
+	if (BenchNumPauses < BENCH_MAX_PAUSES)
+	{
+		BenchPauses[BenchNumPauses++] = GCLastPauseNs;
+	}
+}
+
+/* count an allocation of Size bytes that returned Ptr and record the pause of a collection it ran */
+static inline void *benchCount(void *Ptr, size_t Size)
+{
+	if (Ptr == NULL)
+	{
+		printf("unable to allocate %zu bytes\n", Size);
+		exit(0);
+	}
+	BenchNumAllocs++;
+	if (NumGCTriggered != BenchSeenGC)
+	{
+		benchRecordPause();
+	}
+	return Ptr;
+}
+
+static inline void *benchAlloc(size_t Size)
+{
+	return benchCount(gc_malloc(Size), Size);
+}
+
+static inline void *benchAllocTyped(size_t Size, gc_layout Layout)
+{
+	return benchCount(gc_malloc_typed(Size, Layout), Size);
+}
+
+static void benchCollect()
+{
+	runGC();
+	benchRecordPause();
+}
+
+static int benchCmpPause(const void *A, const void *B)
+{
+	long long X = *(const long long *)A;
+	long long Y = *(const long long *)B;
+	return (X > Y) - (X < Y);
+}
+
+static double benchPercentileMs(double Pct)
+{
+	if (BenchNumPauses == 0)
+	{
+		return 0;
+	}
+	int Idx = (int)(Pct / 100.0 * (BenchNumPauses - 1) + 0.5);
+	return BenchPauses[Idx] / 1e6;
+}
+
+static void benchReport(const char *Workload)
+{
+	double Elapsed = (benchTimeNs() - BenchStartNs) / 1e9;
+	struct rusage Usage;
+	getrusage(RUSAGE_SELF, &Usage);
+	qsort(BenchPauses, BenchNumPauses, sizeof(long long), benchCmpPause);
+
+	long long TotalPauseNs = 0;
+	for (int i = 0; i < BenchNumPauses; i++)
+	{
+		TotalPauseNs += BenchPauses[i];
+	}
+
+	const char *Format = getenv("BENCH_FORMAT");
+	const char *Run = getenv("BENCH_RUN");
+	const char *Commit = getenv("BENCH_COMMIT");
+	Run = Run ? Run : "0";
+	Commit = Commit ? Commit : "";
+
+	long long BytesAllocated = BenchBytesAllocated >= 0 ? BenchBytesAllocated : NumBytesAllocated;
+	double AllocsPerSec = BenchNumAllocs / Elapsed;
+	double MBPerSec = BytesAllocated / Elapsed / (1 << 20);
+
+	if (Format != NULL && !strcmp(Format, "csv"))
+	{
+		if (getenv("BENCH_HEADER") != NULL)
+		{
+			printf("workload,run,commit,elapsed_s,allocs,bytes_allocated,allocs_per_s,alloc_mb_per_s,"
+				   "gc_count,pause_total_ms,pause_p50_ms,pause_p90_ms,pause_p99_ms,pause_max_ms,"
+				   "peak_rss_kb,bytes_freed\n");
+		}
+		printf("%s,%s,%s,%.6f,%lld,%lld,%.0f,%.2f,%lld,%.3f,%.3f,%.3f,%.3f,%.3f,%ld,%lld\n",
+			   Workload, Run, Commit, Elapsed, BenchNumAllocs, BytesAllocated, AllocsPerSec, MBPerSec,
+			   NumGCTriggered, TotalPauseNs / 1e6, benchPercentileMs(50), benchPercentileMs(90),
+			   benchPercentileMs(99), benchPercentileMs(100), Usage.ru_maxrss, NumBytesFreed);
+	}
+	else
+	{
+		printf("{\"workload\":\"%s\",\"run\":%s,\"commit\":\"%s\",\"elapsed_s\":%.6f,\"allocs\":%lld,"
+			   "\"bytes_allocated\":%lld,\"allocs_per_s\":%.0f,\"alloc_mb_per_s\":%.2f,\"gc_count\":%lld,"
+			   "\"pause_total_ms\":%.3f,\"pause_p50_ms\":%.3f,\"pause_p90_ms\":%.3f,\"pause_p99_ms\":%.3f,"
+			   "\"pause_max_ms\":%.3f,\"peak_rss_kb\":%ld,\"bytes_freed\":%lld}\n",
+			   Workload, Run, Commit, Elapsed, BenchNumAllocs, BytesAllocated, AllocsPerSec, MBPerSec,
+			   NumGCTriggered, TotalPauseNs / 1e6, benchPercentileMs(50), benchPercentileMs(90),
+			   benchPercentileMs(99), benchPercentileMs(100), Usage.ru_maxrss, NumBytesFreed);
+	}
+	fflush(stdout);
+	free(BenchPauses);
+}
+
+#endif
@@ -0,0 +1,48 @@
+/* large-object stress: a small window of live multi-page buffers from BigAlloc. */
+#include "bench.h"
+
+#define WINDOW 8
+
+int main(int argc, char *argv[])
+{
+	int num_allocs = 500;
+	size_t max_size = 16 << 20;
+	if (argc >= 2)
+	{
+		num_allocs = atoi(argv[1]);
+	}
+
+	srand(42);
+	benchBegin();
+	char **window = benchAlloc(sizeof(char *) * WINDOW);
+	for (int i = 0; i < WINDOW; i++)
+	{
+		window[i] = NULL;
+	}
+
+	long sum = 0;
+	for (int i = 0; i < num_allocs; i++)
+	{
+		/* sizes spread over 8KB .. max_size on a log scale */
+		int shift = 13 + rand() % 12;
+		size_t size = ((size_t)1 << shift) + rand() % 4096;
+		if (size > max_size)
+		{
+			size = max_size;
+		}
+		char *buf = benchAlloc(size);
+		buf[0] = (char)i;
+		buf[size / 2] = (char)i;
+		buf[size - 1] = (char)i;
+		sum += buf[size / 2];
+		window[rand() % WINDOW] = buf;
+	}
+	benchCollect();
+
+	if (sum == 0)
+	{
+		printf("unexpected checksum\n");
+	}
+	benchReport("bigalloc");
+	return 0;
+}
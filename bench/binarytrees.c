@@ -0,0 +1,70 @@
+/* binary-trees: many short-lived complete trees next to one long-lived tree. */
+#include "bench.h"
+
+struct tree
+{
+	struct tree *left;
+	struct tree *right;
+};
+
+static struct tree *bottom_up(int depth)
+{
+	struct tree *t = benchAlloc(sizeof(struct tree));
+	if (depth > 0)
+	{
+		t->left = bottom_up(depth - 1);
+		t->right = bottom_up(depth - 1);
+	}
+	else
+	{
+		t->left = NULL;
+		t->right = NULL;
+	}
+	return t;
+}
+
+static long check(struct tree *t)
+{
+	if (t->left == NULL)
+	{
+		return 1;
+	}
+	return 1 + check(t->left) + check(t->right);
+}
+
+int main(int argc, char *argv[])
+{
+	int max_depth = 16;
+	if (argc >= 2)
+	{
+		max_depth = atoi(argv[1]);
+	}
+	int min_depth = 4;
+	if (max_depth < min_depth + 2)
+	{
+		max_depth = min_depth + 2;
+	}
+
+	benchBegin();
+	long total = check(bottom_up(max_depth + 1));
+
+	struct tree *long_lived = bottom_up(max_depth);
+
+	for (int depth = min_depth; depth <= max_depth; depth += 2)
+	{
+		int iterations = 1 << (max_depth - depth + min_depth);
+		for (int i = 0; i < iterations; i++)
+		{
+			total += check(bottom_up(depth));
+		}
+	}
+	total += check(long_lived);
+	benchCollect();
+
+	if (total == 0)
+	{
+		printf("unexpected checksum\n");
+	}
+	benchReport("binarytrees");
+	return 0;
+}
@@ -0,0 +1,66 @@
+/* long-lived cache: a large, mostly read-only hash table with a small mutation rate. */
+#include "bench.h"
+
+struct entry
+{
+	long key;
+	long value[6];
+	struct entry *next;
+};
+
+int main(int argc, char *argv[])
+{
+	int num_buckets = 1 << 14;
+	int num_keys = 100000;
+	long num_ops = 2000000;
+	int mutate_per_mille = 10;
+	if (argc >= 2)
+	{
+		num_ops = atol(argv[1]);
+	}
+
+	srand(42);
+	benchBegin();
+	struct entry **table = benchAlloc(sizeof(struct entry *) * num_buckets);
+	for (int i = 0; i < num_buckets; i++)
+	{
+		table[i] = NULL;
+	}
+	for (int k = 0; k < num_keys; k++)
+	{
+		struct entry *e = benchAlloc(sizeof(struct entry));
+		e->key = k;
+		e->value[0] = k;
+		e->next = table[k % num_buckets];
+		table[k % num_buckets] = e;
+	}
+
+	long hits = 0;
+	for (long op = 0; op < num_ops; op++)
+	{
+		long key = rand() % num_keys;
+		struct entry **link = &table[key % num_buckets];
+		while ((*link)->key != key)
+		{
+			link = &(*link)->next;
+		}
+		hits += (*link)->value[0];
+		if (rand() % 1000 < mutate_per_mille)
+		{
+			/* replace the entry; the old one becomes garbage */
+			struct entry *e = benchAlloc(sizeof(struct entry));
+			e->key = key;
+			e->value[0] = (*link)->value[0] + 1;
+			e->next = (*link)->next;
+			*link = e;
+		}
+	}
+	benchCollect();
+
+	if (hits == 0)
+	{
+		printf("unexpected checksum\n");
+	}
+	benchReport("cache");
+	return 0;
+}
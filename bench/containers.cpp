@@ -0,0 +1,191 @@
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../safegc.hpp"
+#include "bench.h"
+
+/* Container-heavy workload run with std::allocator, with safegc::allocator,
+ * and with everything allocated by plain gc_malloc, each in its own process
+ * so that peak RSS is its own: vectors of ints grown by push_back, an
+ * unordered_map filled and probed, and rows of doubles, all next to a large
+ * long-lived table of doubles.  With safegc::allocator the number arrays are
+ * allocated pointer-free, so the collector neither scans the table nor the
+ * vectors' storage; the scanned variant shows what that saves.  The bytes
+ * requested from the allocator are counted the same way in every variant.
+ *
+ * Without arguments all variants run; "std", "safegc" or "scanned" runs one.
+ */
+
+#define ROUNDS 40
+#define VECTOR_INTS 200000
+#define MAP_ENTRIES 50000
+#define ROWS 200
+#define ROW_DOUBLES 500
+#define TABLE_DOUBLES (8 << 20)
+
+enum Backend
+{
+	STD_ALLOCATOR,
+	SAFEGC_ALLOCATOR,
+	SCANNED_GC_MALLOC
+};
+
+/* counts allocations and notices collections, then defers to the backend */
+template <class T, Backend B>
+struct BenchAllocator
+{
+	using value_type = T;
+
+	BenchAllocator() noexcept = default;
+
+	template <class U>
+	BenchAllocator(const BenchAllocator<U, B> &) noexcept
+	{
+	}
+
+	template <class U>
+	struct rebind
+	{
+		using other = BenchAllocator<U, B>;
+	};
+
+	T *allocate(size_t N)
+	{
+		T *Ptr;
+		if (B == STD_ALLOCATOR)
+		{
+			Ptr = std::allocator<T>().allocate(N);
+		}
+		else if (B == SAFEGC_ALLOCATOR)
+		{
+			Ptr = safegc::allocator<T>().allocate(N);
+		}
+		else
+		{
+			Ptr = static_cast<T *>(safegc::allocate_bytes<false>(N * sizeof(T)));
+		}
+		BenchNumAllocs++;
+		BenchBytesAllocated += N * sizeof(T);
+		if (NumGCTriggered != BenchSeenGC)
+		{
+			benchRecordPause();
+		}
+		return Ptr;
+	}
+
+	void deallocate(T *Ptr, size_t N) noexcept
+	{
+		if (B == STD_ALLOCATOR)
+		{
+			std::allocator<T>().deallocate(Ptr, N);
+		}
+	}
+
+	friend bool operator==(const BenchAllocator &, const BenchAllocator &) noexcept
+	{
+		return true;
+	}
+
+	friend bool operator!=(const BenchAllocator &, const BenchAllocator &) noexcept
+	{
+		return false;
+	}
+};
+
+template <Backend B>
+static long runContainers()
+{
+	using Doubles = std::vector<double, BenchAllocator<double, B>>;
+	using Ints = std::vector<int, BenchAllocator<int, B>>;
+	using Rows = std::vector<Doubles, BenchAllocator<Doubles, B>>;
+	using Map = std::unordered_map<long, long, std::hash<long>, std::equal_to<long>,
+								   BenchAllocator<std::pair<const long, long>, B>>;
+	long Check = 0;
+
+	Doubles Table(TABLE_DOUBLES);
+	for (size_t i = 0; i < Table.size(); i++)
+	{
+		Table[i] = i * 0.5;
+	}
+
+	for (int Round = 0; Round < ROUNDS; Round++)
+	{
+		Ints V;
+		for (int i = 0; i < VECTOR_INTS; i++)
+		{
+			V.push_back(i ^ Round);
+		}
+		Check += V[V.size() / 2];
+
+		Map M;
+		for (long i = 0; i < MAP_ENTRIES; i++)
+		{
+			M[i * 7 + Round] = i;
+		}
+		for (long i = 0; i < MAP_ENTRIES; i++)
+		{
+			Check += M.count(i);
+		}
+
+		Rows R;
+		for (int r = 0; r < ROWS; r++)
+		{
+			R.emplace_back(ROW_DOUBLES, r * 1.0);
+		}
+		Check += (long)R[ROWS / 2][ROW_DOUBLES / 2];
+	}
+	Check += (long)Table[TABLE_DOUBLES - 1];
+	return Check;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		const char *Variants[] = {"std", "safegc", "scanned"};
+		for (int i = 0; i < 3; i++)
+		{
+			fflush(stdout);
+			pid_t Pid = fork();
+			if (Pid == 0)
+			{
+				execl("/proc/self/exe", argv[0], Variants[i], (char *)NULL);
+				printf("unable to run the %s variant\n", Variants[i]);
+				exit(1);
+			}
+			waitpid(Pid, NULL, 0);
+		}
+		return 0;
+	}
+
+	char Workload[64];
+	long Check;
+	snprintf(Workload, sizeof(Workload), "containers-%s", argv[1]);
+	BenchBytesAllocated = 0;
+	benchBegin();
+	if (!strcmp(argv[1], "safegc"))
+	{
+		Check = runContainers<SAFEGC_ALLOCATOR>();
+	}
+	else if (!strcmp(argv[1], "scanned"))
+	{
+		Check = runContainers<SCANNED_GC_MALLOC>();
+	}
+	else if (!strcmp(argv[1], "std"))
+	{
+		Check = runContainers<STD_ALLOCATOR>();
+	}
+	else
+	{
+		printf("unknown variant %s\n", argv[1]);
+		return 1;
+	}
+	if (Check == 0)
+	{
+		printf("unexpected checksum\n");
+	}
+	benchReport(Workload);
+	return 0;
+}
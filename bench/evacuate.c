@@ -0,0 +1,93 @@
+/* sparse survivors: typed lists thinned to one node in 64, so most pages keep a few live objects.
+ * The nodes are typed, and each points to an untyped payload that nothing
+ * else references, so both can be evacuated.  Every round adds its
+ * survivors to the long-lived list and collects, and the whole list is
+ * checked after every round, so nodes and payloads that were moved more
+ * than once are checked too.  The evacuation totals and the committed heap
+ * are printed to stderr; run it with SAFEGC_EVACUATE=0 to compare.
+ */
+#include "bench.h"
+
+#define KEEP_EVERY 64
+#define PAYLOAD_SIZE 24
+
+struct node
+{
+	struct node *next;
+	unsigned char *payload;
+	long value;
+	long check;
+};
+
+static struct node *Kept;
+
+/* returns the number of nodes, or -1 if one of them was corrupted */
+static long checkList(struct node *n)
+{
+	long count = 0;
+	for (; n != NULL; n = n->next)
+	{
+		if (n->check != ~n->value || n->payload[0] != (unsigned char)n->value ||
+			n->payload[PAYLOAD_SIZE - 1] != (unsigned char)n->value)
+		{
+			return -1;
+		}
+		count++;
+	}
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	int rounds = 8;
+	long num_nodes = 400000;
+	if (argc >= 2)
+	{
+		rounds = atoi(argv[1]);
+	}
+
+	benchBegin();
+	for (int round = 0; round < rounds; round++)
+	{
+		struct node *fresh = NULL;
+		for (long i = 0; i < num_nodes; i++)
+		{
+			struct node *n = benchAllocTyped(sizeof(struct node), GC_LAYOUT(4, 0x3));
+			n->value = round * num_nodes + i;
+			n->check = ~n->value;
+			n->payload = benchAlloc(PAYLOAD_SIZE);
+			memset(n->payload, (int)(n->value & 0xff), PAYLOAD_SIZE);
+			n->next = fresh;
+			fresh = n;
+		}
+
+		/* keep one node in KEEP_EVERY and put the survivors in front of the older ones */
+		struct node *tail = fresh;
+		for (struct node *n = fresh; n != NULL; n = n->next)
+		{
+			struct node *keep = n->next;
+			for (int k = 1; k < KEEP_EVERY && keep != NULL; k++)
+			{
+				keep = keep->next;
+			}
+			n->next = keep;
+			tail = n;
+		}
+		tail->next = Kept;
+		Kept = fresh;
+
+		benchCollect();
+		if (checkList(Kept) != (round + 1) * ((num_nodes + KEEP_EVERY - 1) / KEEP_EVERY))
+		{
+			printf("the list was corrupted in round %d\n", round);
+			exit(1);
+		}
+	}
+
+	struct gc_stats stats;
+	gc_get_stats(&stats);
+	benchReport("evacuate");
+	fprintf(stderr, "evacuate: %llu bytes evacuated, %llu bytes committed, %llu bytes live\n",
+			stats.total_evacuated_bytes, stats.committed_bytes, stats.live_bytes);
+	return 0;
+}
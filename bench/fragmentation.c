@@ -0,0 +1,62 @@
+/* fragmentation: mixed small sizes where random survivors pin sparsely used pages. */
+#include "bench.h"
+
+static size_t pick_size()
+{
+	/* mostly tiny objects with an occasional one close to a page */
+	int r = rand() % 100;
+	if (r < 60)
+	{
+		return 8 + rand() % 56;
+	}
+	if (r < 90)
+	{
+		return 64 + rand() % 448;
+	}
+	return 512 + rand() % 3000;
+}
+
+int main(int argc, char *argv[])
+{
+	int num_slots = 20000;
+	long num_ops = 1000000;
+	if (argc >= 2)
+	{
+		num_ops = atol(argv[1]);
+	}
+
+	srand(42);
+	benchBegin();
+	char **slots = benchAlloc(sizeof(char *) * num_slots);
+	for (int i = 0; i < num_slots; i++)
+	{
+		slots[i] = NULL;
+	}
+
+	long sum = 0;
+	for (long op = 0; op < num_ops; op++)
+	{
+		size_t size = pick_size();
+		char *p = benchAlloc(size);
+		p[0] = (char)op;
+		p[size - 1] = (char)op;
+		/* only one allocation in eight replaces a survivor */
+		if ((op & 7) == 0)
+		{
+			int s = rand() % num_slots;
+			if (slots[s] != NULL)
+			{
+				sum += slots[s][0];
+			}
+			slots[s] = p;
+		}
+	}
+	benchCollect();
+
+	if (sum == 0)
+	{
+		printf("unexpected checksum\n");
+	}
+	benchReport("fragmentation");
+	return 0;
+}
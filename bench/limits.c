@@ -0,0 +1,127 @@
+/* heap limits: list churn under a soft limit, then a live list grown into a hard limit.
+ * Under the soft limit the committed heap must stay below it, where the
+ * default trigger alone would let it grow well past.  Under the hard limit
+ * the first failing allocation calls the out-of-memory handler, which drops
+ * a reserve list and retries; the next failure finds no reserve and must
+ * come back as NULL, with the heap still inside the limit.  After the list
+ * is dropped, allocation works again.
+ */
+#include "bench.h"
+
+#define SOFT_LIMIT (24 << 20)
+#define HARD_HEADROOM (16 << 20)
+#define RESERVE_CELLS 100000
+
+struct cell
+{
+	long value;
+	struct cell *next;
+};
+
+static struct cell *List;
+static struct cell *Reserve;
+static int OomCalls;
+
+static unsigned long long committedBytes()
+{
+	struct gc_stats stats;
+	gc_get_stats(&stats);
+	return stats.committed_bytes;
+}
+
+static void *onOutOfMemory(size_t size)
+{
+	OomCalls++;
+	if (Reserve == NULL)
+	{
+		return NULL;
+	}
+	/* give the reserve back to the heap and try again */
+	Reserve = NULL;
+	return gc_malloc(size);
+}
+
+static struct cell *grow(struct cell *list, long num_cells)
+{
+	for (long i = 0; i < num_cells; i++)
+	{
+		struct cell *c = gc_malloc(sizeof(struct cell));
+		if (c == NULL)
+		{
+			break;
+		}
+		benchCount(c, sizeof(struct cell));
+		c->value = i;
+		c->next = list;
+		list = c;
+	}
+	return list;
+}
+
+int main(int argc, char *argv[])
+{
+	long num_cells = 4000000;
+	if (argc >= 2)
+	{
+		num_cells = atol(argv[1]);
+	}
+
+	benchBegin();
+	/* soft limit: lists of up to 100000 cells, about 3MB, churned well past the trigger */
+	gc_set_heap_limits(SOFT_LIMIT, 0);
+	unsigned long long peak = 0;
+	long len = 0;
+	for (long i = 0; i < num_cells; i++)
+	{
+		struct cell *c = benchAlloc(sizeof(struct cell));
+		c->value = i;
+		c->next = List;
+		List = c;
+		if (++len == 100000)
+		{
+			List = NULL;
+			len = 0;
+		}
+		if (i % 4096 == 0)
+		{
+			unsigned long long committed = committedBytes();
+			peak = committed > peak ? committed : peak;
+		}
+	}
+	if (peak > SOFT_LIMIT)
+	{
+		printf("the heap reached %llu bytes under a soft limit of %d\n", peak, SOFT_LIMIT);
+		exit(1);
+	}
+	List = NULL;
+	benchCollect();
+
+	/* hard limit: grow a live list until allocation fails */
+	unsigned long long hard = committedBytes() + HARD_HEADROOM;
+	gc_set_heap_limits(0, hard);
+	gc_set_oom_handler(onOutOfMemory);
+	Reserve = grow(NULL, RESERVE_CELLS);
+	List = grow(NULL, num_cells * 4);
+	if (OomCalls != 2 || Reserve != NULL)
+	{
+		printf("the out-of-memory handler ran %d times instead of 2\n", OomCalls);
+		exit(1);
+	}
+	if (committedBytes() > hard)
+	{
+		printf("the heap reached %llu bytes under a hard limit of %llu\n", committedBytes(), hard);
+		exit(1);
+	}
+	List = NULL;
+	benchCollect();
+	if (grow(NULL, RESERVE_CELLS) == NULL)
+	{
+		printf("allocation still fails after the live list was dropped\n");
+		exit(1);
+	}
+	gc_set_oom_handler(NULL);
+	gc_set_heap_limits(0, 0);
+
+	benchReport("limits");
+	return 0;
+}
@@ -0,0 +1,62 @@
+/* linked-list churn: lists that keep growing at the head and losing their tails. */
+#include "bench.h"
+
+struct cell
+{
+	long value;
+	struct cell *next;
+};
+
+int main(int argc, char *argv[])
+{
+	int num_lists = 64;
+	int max_len = 512;
+	long num_ops = 2000000;
+	if (argc >= 2)
+	{
+		num_ops = atol(argv[1]);
+	}
+
+	srand(42);
+	benchBegin();
+	struct cell **lists = benchAlloc(sizeof(struct cell *) * num_lists);
+	int *lens = benchAlloc(sizeof(int) * num_lists);
+	for (int i = 0; i < num_lists; i++)
+	{
+		lists[i] = NULL;
+		lens[i] = 0;
+	}
+
+	long sum = 0;
+	for (long op = 0; op < num_ops; op++)
+	{
+		int l = rand() % num_lists;
+		struct cell *c = benchAlloc(sizeof(struct cell));
+		c->value = op;
+		c->next = lists[l];
+		lists[l] = c;
+		lens[l]++;
+
+		if (lens[l] > max_len)
+		{
+			/* cut the list at a random point; the tail becomes garbage */
+			int keep = 1 + rand() % max_len;
+			struct cell *p = lists[l];
+			for (int k = 1; k < keep; k++)
+			{
+				sum += p->value;
+				p = p->next;
+			}
+			p->next = NULL;
+			lens[l] = keep;
+		}
+	}
+	benchCollect();
+
+	if (sum == 0)
+	{
+		printf("unexpected checksum\n");
+	}
+	benchReport("listchurn");
+	return 0;
+}
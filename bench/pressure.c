@@ -0,0 +1,131 @@
+/* memory pressure: list churn while stand-in cgroup files report rising and falling pressure.
+ * The bench writes memory.current, memory.max and memory.pressure into a
+ * temporary directory and points the memory monitor at it through
+ * SAFEGC_CGROUP_DIR.  High usage and then a high PSI stall must each start
+ * one pressure collection, and quiet phases must start none.
+ */
+#include <unistd.h>
+#include "bench.h"
+
+#define MONITOR_MS 10
+#define MAX_BYTES (1ULL << 30)
+
+struct cell
+{
+	long value;
+	struct cell *next;
+};
+
+static char Dir[] = "/tmp/safegc-pressure-XXXXXX";
+static struct cell *List;
+
+static void writeFile(const char *name, const char *text)
+{
+	char path[sizeof(Dir) + 32];
+	snprintf(path, sizeof(path), "%s/%s", Dir, name);
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+	{
+		printf("unable to write %s\n", path);
+		exit(1);
+	}
+	fputs(text, file);
+	fclose(file);
+}
+
+/* report usage as percent of memory.max and stall as the "some" avg10 */
+static void setPressure(int percent, double stall)
+{
+	char text[128];
+	snprintf(text, sizeof(text), "%llu\n", MAX_BYTES / 100 * percent);
+	writeFile("memory.current", text);
+	snprintf(text, sizeof(text), "some avg10=%.2f avg60=0.00 avg300=0.00 total=0\n"
+								 "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n",
+			 stall);
+	writeFile("memory.pressure", text);
+	/* let the monitor poll the files a few times */
+	usleep(5 * MONITOR_MS * 1000);
+}
+
+/* grow the list and drop it every 1000 cells; the monitor's requests are served in the slow path */
+static void churn(long num_cells)
+{
+	long len = 0;
+	for (long i = 0; i < num_cells; i++)
+	{
+		struct cell *c = benchAlloc(sizeof(struct cell));
+		c->value = i;
+		c->next = List;
+		List = c;
+		if (++len == 1000)
+		{
+			List = NULL;
+			len = 0;
+		}
+	}
+}
+
+static void expectCollections(const char *phase, unsigned long long expected)
+{
+	struct gc_stats stats;
+	gc_get_stats(&stats);
+	if (stats.pressure_collections != expected)
+	{
+		printf("%s: %llu pressure collections instead of %llu\n", phase, stats.pressure_collections, expected);
+		exit(1);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	long num_cells = 200000;
+	if (argc >= 2)
+	{
+		num_cells = atol(argv[1]);
+	}
+	if (mkdtemp(Dir) == NULL)
+	{
+		printf("unable to create a directory for the cgroup files\n");
+		return 1;
+	}
+	char text[64];
+	snprintf(text, sizeof(text), "%llu\n", MAX_BYTES);
+	writeFile("memory.max", text);
+	setPressure(10, 0);
+
+	struct gc_memory_monitor_config config = {NULL, NULL, NULL, MONITOR_MS};
+	setenv("SAFEGC_CGROUP_DIR", Dir, 1);
+	if (gc_start_memory_monitor(&config) != 0)
+	{
+		return 1;
+	}
+
+	benchBegin();
+	churn(num_cells);
+	expectCollections("low usage", 0);
+
+	setPressure(95, 0);
+	churn(num_cells);
+	expectCollections("high usage", 1);
+
+	setPressure(60, 0);
+	churn(num_cells);
+	expectCollections("normal usage", 1);
+
+	setPressure(60, 50);
+	churn(num_cells);
+	expectCollections("high stall", 2);
+
+	gc_stop_memory_monitor();
+	benchReport("pressure");
+
+	const char *names[] = {"memory.current", "memory.max", "memory.pressure"};
+	for (int i = 0; i < 3; i++)
+	{
+		char path[sizeof(Dir) + 32];
+		snprintf(path, sizeof(path), "%s/%s", Dir, names[i]);
+		unlink(path);
+	}
+	rmdir(Dir);
+	return 0;
+}
@@ -0,0 +1,223 @@
+#include "bench.h"
+
+/* Replay an allocation trace recorded with SAFEGC_TRACE or gc_trace_start.
+ *
+ *   safegc-replay [-c] trace
+ *
+ * Every traced allocation is repeated with the same size.  The replayed
+ * object stays reachable until the trace shows the original being freed, so
+ * the live heap follows the traced one while this run's collector decides
+ * on its own when to collect.  With -c a collection is also run wherever
+ * the traced program collected.  The result record is printed like the
+ * other benchmarks, with a summary of the trace on stderr.
+ */
+
+#define TRACE_CHUNK 4096
+
+/* Traced address -> replayed object.  Open addressing with linear probing;
+ * Objects lives in libc memory and is registered as a root range.
+ */
+static unsigned long long *Keys = NULL;
+static void **Objects = NULL;
+static size_t Capacity = 0;
+static size_t NumLive = 0;
+
+static size_t slotOf(unsigned long long Addr)
+{
+	return (size_t)((Addr >> 3) * 0x9e3779b97f4a7c15ULL) & (Capacity - 1);
+}
+
+static void insertObject(unsigned long long Addr, void *Obj);
+
+static void growTable()
+{
+	unsigned long long *OldKeys = Keys;
+	void **OldObjects = Objects;
+	size_t OldCapacity = Capacity;
+	size_t i;
+
+	Capacity = Capacity ? Capacity * 2 : 1 << 16;
+	Keys = calloc(Capacity, sizeof(unsigned long long));
+	Objects = calloc(Capacity, sizeof(void *));
+	if (Keys == NULL || Objects == NULL)
+	{
+		printf("unable to allocate replay table\n");
+		exit(0);
+	}
+	gc_add_roots(Objects, Objects + Capacity);
+	NumLive = 0;
+	for (i = 0; i < OldCapacity; i++)
+	{
+		if (OldKeys[i] != 0)
+		{
+			insertObject(OldKeys[i], OldObjects[i]);
+		}
+	}
+	if (OldObjects != NULL)
+	{
+		gc_remove_roots(OldObjects, OldObjects + OldCapacity);
+	}
+	free(OldKeys);
+	free(OldObjects);
+}
+
+static void insertObject(unsigned long long Addr, void *Obj)
+{
+	if ((NumLive + 1) * 2 > Capacity)
+	{
+		growTable();
+	}
+	size_t Idx = slotOf(Addr);
+	while (Keys[Idx] != 0 && Keys[Idx] != Addr)
+	{
+		Idx = (Idx + 1) & (Capacity - 1);
+	}
+	if (Keys[Idx] == 0)
+	{
+		NumLive++;
+	}
+	Keys[Idx] = Addr;
+	Objects[Idx] = Obj;
+}
+
+/* forget Addr, shifting later entries of its probe run back into the hole;
+ * returns the object Addr was mapped to, or NULL
+ */
+static void *removeObject(unsigned long long Addr)
+{
+	if (Capacity == 0)
+	{
+		return NULL;
+	}
+	size_t Mask = Capacity - 1;
+	size_t Idx = slotOf(Addr);
+	while (Keys[Idx] != Addr)
+	{
+		if (Keys[Idx] == 0)
+		{
+			return NULL;
+		}
+		Idx = (Idx + 1) & Mask;
+	}
+	void *Obj = Objects[Idx];
+	size_t Next = Idx;
+	for (;;)
+	{
+		Next = (Next + 1) & Mask;
+		if (Keys[Next] == 0)
+		{
+			break;
+		}
+		size_t Home = slotOf(Keys[Next]);
+		/* the entry at Next may move to Idx unless its home lies in (Idx, Next] */
+		if (((Next - Home) & Mask) >= ((Next - Idx) & Mask))
+		{
+			Keys[Idx] = Keys[Next];
+			Objects[Idx] = Objects[Next];
+			Idx = Next;
+		}
+	}
+	Keys[Idx] = 0;
+	Objects[Idx] = NULL;
+	NumLive--;
+	return Obj;
+}
+
+int main(int argc, char **argv)
+{
+	int FollowCollections = 0;
+	const char *Path = NULL;
+	struct gc_trace_header Header;
+	struct gc_trace_record *Records;
+	long long NumAllocRecords = 0, NumFreeRecords = 0, NumCollectRecords = 0;
+	unsigned long long TracedPauseNs = 0, TracedMaxPauseNs = 0, TracedNs = 0;
+	size_t Count, i;
+
+	for (i = 1; i < (size_t)argc; i++)
+	{
+		if (!strcmp(argv[i], "-c"))
+		{
+			FollowCollections = 1;
+		}
+		else
+		{
+			Path = argv[i];
+		}
+	}
+	if (Path == NULL)
+	{
+		printf("usage: %s [-c] trace\n", argv[0]);
+		return 1;
+	}
+	FILE *In = fopen(Path, "rb");
+	if (In == NULL)
+	{
+		printf("unable to open %s\n", Path);
+		return 1;
+	}
+	if (fread(&Header, sizeof(Header), 1, In) != 1 || memcmp(Header.magic, GC_TRACE_MAGIC, sizeof(Header.magic)) ||
+		Header.version != GC_TRACE_VERSION || Header.record_size != sizeof(struct gc_trace_record))
+	{
+		printf("%s is not a SafeGC trace of version %d\n", Path, GC_TRACE_VERSION);
+		return 1;
+	}
+	Records = malloc(TRACE_CHUNK * sizeof(struct gc_trace_record));
+	if (Records == NULL)
+	{
+		printf("unable to allocate trace buffer\n");
+		return 1;
+	}
+
+	benchBegin();
+	while ((Count = fread(Records, sizeof(struct gc_trace_record), TRACE_CHUNK, In)) > 0)
+	{
+		for (i = 0; i < Count; i++)
+		{
+			struct gc_trace_record *Record = &Records[i];
+			TracedNs = Record->time_ns;
+			switch (Record->kind)
+			{
+			case GC_TRACE_ALLOC:
+				insertObject(Record->addr, benchAlloc(Record->size));
+				NumAllocRecords++;
+				break;
+			case GC_TRACE_FREE:
+				removeObject(Record->addr);
+				NumFreeRecords++;
+				break;
+			case GC_TRACE_MOVE:
+				/* the traced object now lives at the address in size */
+				{
+					void *Obj = removeObject(Record->addr);
+					if (Obj != NULL)
+					{
+						insertObject(Record->size, Obj);
+					}
+				}
+				break;
+			case GC_TRACE_COLLECT:
+				if (FollowCollections)
+				{
+					benchCollect();
+				}
+				TracedPauseNs += Record->addr;
+				if (Record->addr > TracedMaxPauseNs)
+				{
+					TracedMaxPauseNs = Record->addr;
+				}
+				NumCollectRecords++;
+				break;
+			}
+		}
+	}
+	fclose(In);
+	free(Records);
+
+	benchReport("replay");
+	fprintf(stderr,
+			"trace %s: %.3f s, %lld allocations, %lld frees, %lld collections, "
+			"pause total %.3f ms, max %.3f ms, %zu objects live at the end\n",
+			Path, TracedNs / 1e9, NumAllocRecords, NumFreeRecords, NumCollectRecords, TracedPauseNs / 1e6,
+			TracedMaxPauseNs / 1e6, NumLive);
+	return 0;
+}
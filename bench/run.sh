@@ -0,0 +1,51 @@
+#!/bin/sh
+# Run every GC benchmark workload N times and print one record per run.
+#
+# usage: bench/run.sh [-n runs] [-f json|csv] [-o file] [workload ...]
+#
+# Records are JSON lines by default; -f csv prints a single header followed
+# by one row per run.  Each record carries the run index and the current git
+# commit, so results from different commits can be concatenated and compared.
+
+RUNS=5
+FORMAT=json
+OUT=
+
+while getopts "n:f:o:" opt; do
+	case $opt in
+	n) RUNS=$OPTARG ;;
+	f) FORMAT=$OPTARG ;;
+	o) OUT=$OPTARG ;;
+	*) echo "usage: $0 [-n runs] [-f json|csv] [-o file] [workload ...]" >&2; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+WORKLOADS=${*:-"binarytrees listchurn bigalloc fragmentation cache threads containers arena evacuate pressure limits"}
+COMMIT=$(git -C "$DIR" rev-parse --short HEAD 2>/dev/null)
+
+if [ -n "$OUT" ]; then
+	exec >"$OUT"
+fi
+
+HEADER=1
+for w in $WORKLOADS; do
+	if [ ! -x "$DIR/$w" ]; then
+		echo "missing workload $w, run 'make bench' first" >&2
+		exit 1
+	fi
+	i=1
+	while [ "$i" -le "$RUNS" ]; do
+		# keep only result records; the collector may print diagnostics of its own
+		if [ "$FORMAT" = csv ] && [ -n "$HEADER" ]; then
+			BENCH_HEADER=1 BENCH_FORMAT=csv BENCH_RUN=$i BENCH_COMMIT=$COMMIT "$DIR/$w" |
+				grep -E "^(workload,|$w[-,])"
+			HEADER=
+		else
+			BENCH_FORMAT=$FORMAT BENCH_RUN=$i BENCH_COMMIT=$COMMIT "$DIR/$w" |
+				grep -E "^(\{\"workload\"|$w[-,])"
+		fi
+		i=$((i + 1))
+	done
+done
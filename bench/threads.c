@@ -0,0 +1,73 @@
+/* multi-threaded allocation: several threads churning lists through one allocator.
+ * The allocator is not thread-safe and only scans the stack of the thread that
+ * collects, so every allocation happens under a lock and each thread keeps its
+ * live data reachable only from the global Roots[] table between critical sections.
+ */
+#include <pthread.h>
+#include "bench.h"
+
+#define MAX_THREADS 16
+
+struct cell
+{
+	long value;
+	struct cell *next;
+};
+
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cell *Roots[MAX_THREADS];
+static long OpsPerThread = 500000;
+
+static void *worker(void *arg)
+{
+	long id = (long)arg;
+	long len = 0;
+	for (long op = 0; op < OpsPerThread; op++)
+	{
+		pthread_mutex_lock(&Lock);
+		struct cell *c = benchAlloc(sizeof(struct cell));
+		c->value = op;
+		c->next = Roots[id];
+		Roots[id] = c;
+		if (++len == 1000)
+		{
+			/* drop the whole list */
+			Roots[id] = NULL;
+			len = 0;
+		}
+		pthread_mutex_unlock(&Lock);
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int num_threads = 4;
+	if (argc >= 2)
+	{
+		num_threads = atoi(argv[1]);
+		if (num_threads < 1 || num_threads > MAX_THREADS)
+		{
+			printf("thread count must be in [1, %d]\n", MAX_THREADS);
+			return 0;
+		}
+	}
+	if (argc >= 3)
+	{
+		OpsPerThread = atol(argv[2]);
+	}
+
+	benchBegin();
+	pthread_t tids[MAX_THREADS];
+	for (long i = 0; i < num_threads; i++)
+	{
+		pthread_create(&tids[i], NULL, worker, (void *)i);
+	}
+	for (int i = 0; i < num_threads; i++)
+	{
+		pthread_join(tids[i], NULL);
+	}
+	benchCollect();
+	benchReport("threads");
+	return 0;
+}
@@ -1,10 +1,25 @@
 .text
 .globl mymalloc
+.globl mymalloc_atomic
+.globl mymalloc_typed
 .globl runGC
+.globl gc_collect_if_idle
+.globl gc_arena_alloc
 .extern _mymalloc
+.extern _mymalloc_atomic
+.extern _mymalloc_typed
 .extern _runGC
+.extern _gc_collect_if_idle
+.extern _gc_arena_alloc
+# bounds of the trampolines, used by the heap profiler to trim its stack traces
+.globl safegc_trampolines_start
+.globl safegc_trampolines_end
+.hidden safegc_trampolines_start
+.hidden safegc_trampolines_end
 
+safegc_trampolines_start:
 mymalloc:
+	.cfi_startproc
 # nuke caller-saved registers except argument(s)
 	xor %rax, %rax
 	xor %rcx, %rcx
@@ -15,7 +30,10 @@ mymalloc:
 	xor %r10, %r10
 	xor %r11, %r11
 	push %rbp
+	.cfi_def_cfa_offset 16
+	.cfi_offset %rbp, -16
 	mov %rsp, %rbp
+	.cfi_def_cfa_register %rbp
 # move possible register roots on stack
 	push %rbx
 	push %r12
@@ -29,9 +47,77 @@ mymalloc:
 	call *%rax
 	mov %rbp, %rsp
 	pop %rbp
+	.cfi_def_cfa %rsp, 8
 	ret
+	.cfi_endproc
+
+mymalloc_atomic:
+	.cfi_startproc
+# nuke caller-saved registers except argument(s)
+	xor %rax, %rax
+	xor %rcx, %rcx
+	xor %rdx, %rdx
+	xor %rsi, %rsi
+	xor %r8, %r8
+	xor %r9, %r9
+	xor %r10, %r10
+	xor %r11, %r11
+	push %rbp
+	.cfi_def_cfa_offset 16
+	.cfi_offset %rbp, -16
+	mov %rsp, %rbp
+	.cfi_def_cfa_register %rbp
+# move possible register roots on stack
+	push %rbx
+	push %r12
+	push %r13
+	push %r14
+	push %r15
+# put marker on stack
+	push $0x12abcdef
+	sub $16, %rsp
+	movabsq $_mymalloc_atomic, %rax
+	call *%rax
+	mov %rbp, %rsp
+	pop %rbp
+	.cfi_def_cfa %rsp, 8
+	ret
+	.cfi_endproc
+
+mymalloc_typed:
+	.cfi_startproc
+# nuke caller-saved registers except argument(s)
+	xor %rax, %rax
+	xor %rcx, %rcx
+	xor %rdx, %rdx
+	xor %r8, %r8
+	xor %r9, %r9
+	xor %r10, %r10
+	xor %r11, %r11
+	push %rbp
+	.cfi_def_cfa_offset 16
+	.cfi_offset %rbp, -16
+	mov %rsp, %rbp
+	.cfi_def_cfa_register %rbp
+# move possible register roots on stack
+	push %rbx
+	push %r12
+	push %r13
+	push %r14
+	push %r15
+# put marker on stack
+	push $0x12abcdef
+	sub $16, %rsp
+	movabsq $_mymalloc_typed, %rax
+	call *%rax
+	mov %rbp, %rsp
+	pop %rbp
+	.cfi_def_cfa %rsp, 8
+	ret
+	.cfi_endproc
 
 runGC:
+	.cfi_startproc
 # nuke all caller-saved registers
 	xor %rax, %rax
 	xor %rcx, %rcx
@@ -43,7 +129,10 @@ runGC:
 	xor %r10, %r10
 	xor %r11, %r11
 	push %rbp
+	.cfi_def_cfa_offset 16
+	.cfi_offset %rbp, -16
 	mov %rsp, %rbp
+	.cfi_def_cfa_register %rbp
 # move possible register roots on stack
 	push %rbx
 	push %r12
@@ -57,4 +146,72 @@ runGC:
 	call *%rax
 	mov %rbp, %rsp
 	pop %rbp
+	.cfi_def_cfa %rsp, 8
+	ret
+	.cfi_endproc
+
+gc_collect_if_idle:
+	.cfi_startproc
+# nuke caller-saved registers except argument(s)
+	xor %rax, %rax
+	xor %rcx, %rcx
+	xor %rdx, %rdx
+	xor %rsi, %rsi
+	xor %r8, %r8
+	xor %r9, %r9
+	xor %r10, %r10
+	xor %r11, %r11
+	push %rbp
+	.cfi_def_cfa_offset 16
+	.cfi_offset %rbp, -16
+	mov %rsp, %rbp
+	.cfi_def_cfa_register %rbp
+# move possible register roots on stack
+	push %rbx
+	push %r12
+	push %r13
+	push %r14
+	push %r15
+# put marker on stack
+	push $0x12abcdef
+	sub $16, %rsp
+	movabsq $_gc_collect_if_idle, %rax
+	call *%rax
+	mov %rbp, %rsp
+	pop %rbp
+	.cfi_def_cfa %rsp, 8
+	ret
+	.cfi_endproc
+
+gc_arena_alloc:
+	.cfi_startproc
+# nuke caller-saved registers except argument(s)
+	xor %rax, %rax
+	xor %rcx, %rcx
+	xor %rdx, %rdx
+	xor %r8, %r8
+	xor %r9, %r9
+	xor %r10, %r10
+	xor %r11, %r11
+	push %rbp
+	.cfi_def_cfa_offset 16
+	.cfi_offset %rbp, -16
+	mov %rsp, %rbp
+	.cfi_def_cfa_register %rbp
+# move possible register roots on stack
+	push %rbx
+	push %r12
+	push %r13
+	push %r14
+	push %r15
+# put marker on stack
+	push $0x12abcdef
+	sub $16, %rsp
+	movabsq $_gc_arena_alloc, %rax
+	call *%rax
+	mov %rbp, %rsp
+	pop %rbp
+	.cfi_def_cfa %rsp, 8
 	ret
+	.cfi_endproc
+safegc_trampolines_end:
@@ -12,6 +12,14 @@
 #include <elf.h>
 #include <assert.h>
 #include <pthread.h>
+#include <time.h>
+#include <math.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <immintrin.h>
+#include <signal.h>
+#include <sys/syscall.h>
 #include "memory.h"
 
 typedef unsigned long long ulong64;
@@ -23,17 +31,35 @@ typedef unsigned long long ulong64;
 #define METADATA_SIZE ((SEGMENT_SIZE / PAGE_SIZE) * 2)
 #define NUM_PAGES_IN_SEG (METADATA_SIZE / 2)
 #define OTHER_METADATA_SIZE ((METADATA_SIZE / PAGE_SIZE) * 2)
+/* big allocation segments also keep a 4-byte span entry per page after Size[] */
+#define SPAN_METADATA_SIZE (NUM_PAGES_IN_SEG * sizeof(unsigned))
 #define COMMIT_SIZE PAGE_SIZE
 #define Align(x, y) (((x) + (y - 1)) & ~(y - 1))
 #define ADDR_TO_PAGE(x) (char *)(((ulong64)(x)) & ~(PAGE_SIZE - 1))
 #define ADDR_TO_SEGMENT(x) (Segment *)(((ulong64)(x)) & ~(SEGMENT_SIZE - 1))
 #define FREE 1
 #define MARK 2
+/* the object has an entry in the heap profiler's sample table */
+#define SAMPLED 4
+/* a chunk of an arena: never freed by the sweep, only by gc_arena_release */
+#define ARENA 8
+/* the object holds no pointers: it is marked but never scanned */
+#define NOSCAN GC_OBJECT_NOSCAN
+/* the object's Type is a gc_layout and only its pointer words are scanned */
+#define TYPED GC_OBJECT_TYPED
+/* an ambiguous root or word refers to the object, so it must not move */
+#define PINNED 64
+/* the object was evacuated and Type holds the header of its copy */
+#define FORWARDED 128
 #define GC_THRESHOLD (32ULL << 20)
+/* the largest object a big allocation segment can hold, header included */
+#define MAX_ALLOC_SIZE (SEGMENT_SIZE - METADATA_SIZE - SPAN_METADATA_SIZE)
 
 long long NumGCTriggered = 0;
 long long NumBytesFreed = 0;
 long long NumBytesAllocated = 0;
+/* duration of the most recent collection, read by the benchmark harness */
+long long GCLastPauseNs = 0;
 extern char etext, edata, end;
 int unscannedListCount = 0;
 
@@ -44,6 +70,8 @@ struct OtherMetadata
 	char *ReservePtr;
 	char *DataPtr;
 	int BigAlloc;
+	/* side mark bits of a concurrent cycle, see prepareMarkBits */
+	ulong64 *MarkBits;
 };
 
 typedef struct Segment
@@ -68,26 +96,113 @@ typedef struct ObjHeader
 	ulong64 Type;
 } ObjHeader;
 
-// Unscanned List Node represents a node in the Unscanned List.
-// It contains a pointer to the object header and a pointer to the next node in the list.
-typedef struct UnscannedListNode
+#define OBJ_HEADER_SIZE (sizeof(ObjHeader))
+_Static_assert(sizeof(ObjHeader) == sizeof(struct gc_object_header), "gc_malloc writes ObjHeader");
+
+static SegmentList *Segments = NULL;
+
+/* The segments small and big objects are currently allocated from. */
+static Segment *SmallSeg = NULL;
+static Segment *BigSeg = NULL;
+
+/* Bytes allocated since the last collection, checked against gcTrigger(). */
+static long long AllocSinceGC = 0;
+
+/* Memory pressure as last seen by the monitor thread, see gc_start_memory_monitor. */
+enum PressureLevel
 {
-	struct ObjHeader *Object;
-	struct UnscannedListNode *Next;
-} UnscannedListNode;
+	PRESSURE_LOW,
+	PRESSURE_NORMAL,
+	PRESSURE_HIGH
+};
+
+static int MemoryPressure = PRESSURE_NORMAL;
 
-// The Unscanned List is a linked list of Unscanned List Nodes.
-// It contains a pointer to the head and tail of the list.
-typedef struct UnscannedList
+/* bytes to allocate between collections at the current memory pressure */
+static long long gcTrigger()
 {
-	struct UnscannedListNode *Head;
-	struct UnscannedListNode *Tail;
-} UnscannedList;
+	switch (__atomic_load_n(&MemoryPressure, __ATOMIC_RELAXED))
+	{
+	case PRESSURE_LOW:
+		return GC_THRESHOLD * 4;
+	case PRESSURE_HIGH:
+		return GC_THRESHOLD / 4;
+	default:
+		return GC_THRESHOLD;
+	}
+}
 
-#define OBJ_HEADER_SIZE (sizeof(ObjHeader))
+/* The inline fast path in gc_malloc bumps gc_alloc_state without entering the
+ * library.  BudgetGranted is the budget it was last given, so the bytes it has
+ * allocated since are BudgetGranted - gc_alloc_state.budget.
+ */
+struct gc_alloc_state gc_alloc_state = {NULL, NULL, 0};
+static long long BudgetGranted = 0;
 
-static SegmentList *Segments = NULL;
-static UnscannedList *Unscanned = NULL;
+/* Held by every library entry point that changes the heap, so that the idle
+ * timer thread can work on it while the application is quiet.  The inline
+ * fast path does not take it.
+ */
+static pthread_mutex_t HeapLock = PTHREAD_MUTEX_INITIALIZER;
+
+// The unscanned objects are kept on a growable stack of object headers.
+// Popping the most recently marked object first keeps the scan close to
+// the memory that was just touched.
+static ObjHeader **Unscanned = NULL;
+static size_t NumUnscanned = 0;
+static size_t MaxUnscanned = 0;
+
+/* Lowest data pointer and highest alloc pointer over all segments, taken at
+ * the start of a collection.  Words outside this range cannot be heap pointers
+ * and are rejected before any segment lookup.
+ */
+static char *HeapLow = NULL;
+static char *HeapHigh = NULL;
+
+/* The allocated range of every segment, taken together with HeapLow and
+ * HeapHigh.  Marking resolves words against this snapshot rather than the
+ * live segment list, which a concurrent cycle's mutator keeps extending.
+ */
+typedef struct SegmentBounds
+{
+	Segment *Seg;
+	char *DataPtr;
+	char *AllocPtr;
+} SegmentBounds;
+
+static SegmentBounds *HeapSegs = NULL;
+static size_t NumHeapSegs = 0;
+static size_t MaxHeapSegs = 0;
+
+/* A contiguous run of free pages waiting to be returned to the OS. */
+typedef struct PageRange
+{
+	char *Start;
+	size_t Size;
+} PageRange;
+
+/* Free pages found while sweeping are queued here and released in the decommit phase. */
+static PageRange *PendingDecommit = NULL;
+static size_t NumPendingDecommit = 0;
+static size_t MaxPendingDecommit = 0;
+static int DeferDecommit = 0;
+
+/* Pages released with MADV_FREE while memory was plentiful; they stay in the
+ * resident set until the kernel needs them or pressure makes us drop them.
+ */
+static PageRange *LazyFreed = NULL;
+static size_t NumLazyFreed = 0;
+static size_t MaxLazyFreed = 0;
+static int LazyFreeWorks = 1;
+
+/* Statistics reported by gc_get_stats, and the per-collection counters behind them. */
+static struct gc_stats Stats;
+static unsigned long long PhaseNs[GC_NUM_PHASES];
+static long long PhaseStartNs = 0;
+static unsigned long long Candidates = 0;
+static unsigned long long FalsePointers = 0;
+static unsigned long long LiveBytes = 0;
+static unsigned long long LiveObjects = 0;
 
 static void setAllocPtr(Segment *Seg, char *Ptr) { Seg->Other.AllocPtr = Ptr; }
 static void setCommitPtr(Segment *Seg, char *Ptr) { Seg->Other.CommitPtr = Ptr; }
@@ -102,6 +217,74 @@ static int getBigAlloc(Segment *Seg) { return Seg->Other.BigAlloc; }
 static void myfree(void *Ptr);
 static void checkAndRunGC();
 
+static long long getTimeNs()
+{
+	struct timespec Ts;
+	clock_gettime(CLOCK_MONOTONIC, &Ts);
+	return (long long)Ts.tv_sec * 1000000000LL + Ts.tv_nsec;
+}
+
+/* Event tracing.
+ * While a trace is being recorded, every allocation, every object freed by
+ * the sweep and every collection appends a gc_trace_record to TraceBuf,
+ * which is written to the trace file whenever it fills up.  The inline
+ * fast path gets no budget, so every allocation reaches the library.
+ */
+#define TRACE_BUF_RECORDS 4096
+
+static int TraceFd = -1;
+static struct gc_trace_record *TraceBuf = NULL;
+static int NumTraceRecords = 0;
+static long long TraceStartNs = 0;
+static long long TraceLastNs = 0;
+static __thread unsigned TraceThread = 0;
+
+static void flushTrace()
+{
+	char *Buf = (char *)TraceBuf;
+	size_t Left = NumTraceRecords * sizeof(struct gc_trace_record);
+	while (Left > 0)
+	{
+		ssize_t Written = write(TraceFd, Buf, Left);
+		if (Written <= 0)
+		{
+			printf("unable to write the allocation trace\n");
+			break;
+		}
+		Buf += Written;
+		Left -= Written;
+	}
+	NumTraceRecords = 0;
+}
+
+static void traceEvent(unsigned Kind, unsigned long long Addr, unsigned long long Size)
+{
+	if (TraceFd < 0)
+	{
+		return;
+	}
+	if (TraceThread == 0)
+	{
+		TraceThread = syscall(SYS_gettid);
+	}
+	/* the sweep frees objects within one pause, so they share the time of the
+	 * last event rather than each reading the clock */
+	if (Kind != GC_TRACE_FREE)
+	{
+		TraceLastNs = getTimeNs() - TraceStartNs;
+	}
+	struct gc_trace_record *Record = &TraceBuf[NumTraceRecords++];
+	Record->time_ns = TraceLastNs;
+	Record->addr = Addr;
+	Record->size = Size;
+	Record->thread = TraceThread;
+	Record->kind = Kind;
+	if (NumTraceRecords == TRACE_BUF_RECORDS)
+	{
+		flushTrace();
+	}
+}
+
 static void addToSegmentList(Segment *Seg)
 {
 	SegmentList *L = malloc(sizeof(SegmentList));
@@ -117,33 +300,25 @@ static void addToSegmentList(Segment *Seg)
 
 static void addToUnscannedList(struct ObjHeader *Object)
 {
-	struct UnscannedListNode *Node = malloc(sizeof(struct UnscannedListNode));
-	if (Node == NULL)
-	{
-		printf("Unable to allocate list node\n");
-		exit(0);
-	}
-	Node->Object = Object;
-	Node->Next = NULL;
-	if (Unscanned == NULL)
-	{
-		Unscanned = malloc(sizeof(struct UnscannedList));
-		Unscanned->Head = Node;
-		Unscanned->Tail = Node;
-	}
-	else if (Unscanned->Head == NULL || Unscanned->Tail == NULL)
+	if (Object->Status & NOSCAN)
 	{
-		Unscanned->Head = Node;
-		Unscanned->Tail = Node;
+		return;
 	}
-	else
+	if (NumUnscanned == MaxUnscanned)
 	{
-		Unscanned->Tail->Next = Node;
-		Unscanned->Tail = Node;
+		MaxUnscanned = MaxUnscanned ? MaxUnscanned * 2 : 4096;
+		Unscanned = realloc(Unscanned, MaxUnscanned * sizeof(ObjHeader *));
+		if (Unscanned == NULL)
+		{
+			printf("Unable to allocate unscanned list\n");
+			exit(0);
+		}
 	}
+	Unscanned[NumUnscanned++] = Object;
 }
 
-static void allowAccess(void *Ptr, size_t Size)
+/* commit pages for the heap; returns -1 if the OS refuses */
+static int allowAccess(void *Ptr, size_t Size)
 {
 	assert((Size % PAGE_SIZE) == 0);
 	assert(((ulong64)Ptr & (PAGE_SIZE - 1)) == 0);
@@ -151,25 +326,33 @@ static void allowAccess(void *Ptr, size_t Size)
 	int Ret = mprotect(Ptr, Size, PROT_READ | PROT_WRITE);
 	if (Ret == -1)
 	{
-		printf("unable to mprotect %s():%d\n", __func__, __LINE__);
-		exit(0);
+		return -1;
 	}
+	Stats.committed_bytes += Size;
+	return 0;
 }
 
+/* returns NULL if the address space or the metadata cannot be had */
 static Segment *allocateSegment(int BigAlloc)
 {
 	void *Base = mmap(NULL, SEGMENT_SIZE * 2, PROT_NONE, MAP_ANON | MAP_PRIVATE, -1, 0);
 	if (Base == MAP_FAILED)
 	{
-		printf("unable to allocate a segment\n");
-		exit(0);
+		return NULL;
 	}
 
 	/* segments are aligned to segment size */
 	Segment *Segment = (struct Segment *)Align((ulong64)Base, SEGMENT_SIZE);
-	allowAccess(Segment, METADATA_SIZE);
+	size_t MetadataSize = METADATA_SIZE + (BigAlloc ? SPAN_METADATA_SIZE : 0);
+	if (allowAccess(Segment, MetadataSize) != 0)
+	{
+		munmap(Base, SEGMENT_SIZE * 2);
+		return NULL;
+	}
+	Stats.reserved_bytes += SEGMENT_SIZE * 2;
+	Stats.segments++;
 
-	char *AllocPtr = (char *)Segment + METADATA_SIZE;
+	char *AllocPtr = (char *)Segment + MetadataSize;
 	char *ReservePtr = (char *)Segment + SEGMENT_SIZE;
 	setAllocPtr(Segment, AllocPtr);
 	setReservePtr(Segment, ReservePtr);
@@ -180,7 +363,8 @@ static Segment *allocateSegment(int BigAlloc)
 	return Segment;
 }
 
-static void extendCommitSpace(Segment *Seg)
+/* returns -1 if the next page could not be committed */
+static int extendCommitSpace(Segment *Seg)
 {
 	char *AllocPtr = getAllocPtr(Seg);
 	char *CommitPtr = getCommitPtr(Seg);
@@ -190,13 +374,17 @@ static void extendCommitSpace(Segment *Seg)
 	assert(AllocPtr == CommitPtr);
 	if (NewCommitPtr <= ReservePtr)
 	{
-		allowAccess(CommitPtr, COMMIT_SIZE);
+		if (allowAccess(CommitPtr, COMMIT_SIZE) != 0)
+		{
+			return -1;
+		}
 		setCommitPtr(Seg, NewCommitPtr);
 	}
 	else
 	{
 		assert(CommitPtr == ReservePtr);
 	}
+	return 0;
 }
 
 static unsigned short *getSizeMetadata(char *Ptr)
@@ -207,6 +395,21 @@ static unsigned short *getSizeMetadata(char *Ptr)
 	return &Seg->Size[PageNo];
 }
 
+/* In big allocation segments every allocation is a span of whole pages.
+ * Size[] is 1 on the first page of a live span, PAGE_SIZE on the first page
+ * of a free span and 0 on every other page.  The span entry of a first page
+ * holds the length of the span in pages; on the other pages it holds the
+ * distance back to the first page, so any interior address finds its header
+ * with a single lookup.
+ */
+static unsigned *getSpanMetadata(char *Ptr)
+{
+	char *Page = ADDR_TO_PAGE(Ptr);
+	Segment *Seg = ADDR_TO_SEGMENT(Ptr);
+	ulong64 PageNo = (Page - (char *)Seg) / PAGE_SIZE;
+	return (unsigned *)((char *)Seg + METADATA_SIZE) + PageNo;
+}
+
 static void createHole(Segment *Seg)
 {
 	char *AllocPtr = getAllocPtr(Seg);
@@ -224,6 +427,33 @@ static void createHole(Segment *Seg)
 	}
 }
 
+/* append [Ptr, Ptr+Size) to a list of page ranges, merging it with the last range if they touch */
+static void appendPageRange(PageRange **List, size_t *Num, size_t *Max, void *Ptr, size_t Size)
+{
+	if (*Num > 0)
+	{
+		PageRange *Last = &(*List)[*Num - 1];
+		if (Last->Start + Last->Size == (char *)Ptr)
+		{
+			Last->Size += Size;
+			return;
+		}
+	}
+	if (*Num == *Max)
+	{
+		*Max = *Max ? *Max * 2 : 256;
+		*List = realloc(*List, *Max * sizeof(PageRange));
+		if (*List == NULL)
+		{
+			printf("Unable to allocate page range list\n");
+			exit(0);
+		}
+	}
+	(*List)[*Num].Start = Ptr;
+	(*List)[*Num].Size = Size;
+	(*Num)++;
+}
+
 static void reclaimMemory(void *Ptr, size_t Size)
 {
 	assert((Size % PAGE_SIZE) == 0);
@@ -235,6 +465,16 @@ static void reclaimMemory(void *Ptr, size_t Size)
 		printf("unable to mprotect %s():%d\n", __func__, __LINE__);
 		exit(0);
 	}
+	Stats.committed_bytes -= Size;
+	if (LazyFreeWorks && __atomic_load_n(&MemoryPressure, __ATOMIC_RELAXED) == PRESSURE_LOW)
+	{
+		if (madvise(Ptr, Size, MADV_FREE) == 0)
+		{
+			appendPageRange(&LazyFreed, &NumLazyFreed, &MaxLazyFreed, Ptr, Size);
+			return;
+		}
+		LazyFreeWorks = 0;
+	}
 	Ret = madvise(Ptr, Size, MADV_DONTNEED);
 	if (Ret == -1)
 	{
@@ -243,618 +483,3729 @@ static void reclaimMemory(void *Ptr, size_t Size)
 	}
 }
 
-/* used by the GC to free objects. */
-static void myfree(void *Ptr)
+/* drop the pages released with MADV_FREE from the resident set right away */
+static void releaseLazyPages()
 {
-	ObjHeader *Header = (ObjHeader *)((char *)Ptr - OBJ_HEADER_SIZE);
-	assert((Header->Status & FREE) == 0);
-	NumBytesFreed += Header->Size;
-	if (Header->Size > COMMIT_SIZE)
+	size_t i;
+	for (i = 0; i < NumLazyFreed; i++)
 	{
-		assert((Header->Size % PAGE_SIZE) == 0);
-		assert(((ulong64)Header & (PAGE_SIZE - 1)) == 0);
-		size_t Size = Header->Size;
-		char *Start = (char *)Header;
-		size_t Iter;
-		for (Iter = 0; Iter < Size; Iter += PAGE_SIZE)
-		{
-			unsigned short *SzMeta = getSizeMetadata((char *)Start + Iter);
-			SzMeta[0] = PAGE_SIZE;
-		}
-		Header->Status = FREE;
-		reclaimMemory(Header, Header->Size);
-		return;
+		madvise(LazyFreed[i].Start, LazyFreed[i].Size, MADV_DONTNEED);
 	}
+	NumLazyFreed = 0;
+}
 
-	unsigned short *SzMeta = getSizeMetadata((char *)Header);
-	SzMeta[0] += Header->Size;
-	assert(SzMeta[0] <= PAGE_SIZE);
-	Header->Status = FREE;
-	if (SzMeta[0] == PAGE_SIZE)
+/* Return free pages to the OS.  While sweeping, the pages are queued instead
+ * and adjacent ranges are coalesced, so that the decommit phase can release
+ * them with few system calls.
+ */
+static void releasePages(void *Ptr, size_t Size)
+{
+	if (!DeferDecommit)
 	{
-		char *Page = ADDR_TO_PAGE(Ptr);
-		reclaimMemory(Page, PAGE_SIZE);
+		reclaimMemory(Ptr, Size);
+		return;
 	}
+	appendPageRange(&PendingDecommit, &NumPendingDecommit, &MaxPendingDecommit, Ptr, Size);
 }
 
-static void *BigAlloc(size_t Size)
+static void decommitPendingPages()
 {
-	size_t AlignedSize = Align(Size + OBJ_HEADER_SIZE, PAGE_SIZE);
-	assert(AlignedSize <= SEGMENT_SIZE - METADATA_SIZE);
-	static Segment *CurSeg = NULL;
-	if (CurSeg == NULL)
+	size_t i;
+	for (i = 0; i < NumPendingDecommit; i++)
 	{
-		CurSeg = allocateSegment(1);
+		reclaimMemory(PendingDecommit[i].Start, PendingDecommit[i].Size);
 	}
-	char *AllocPtr = getAllocPtr(CurSeg);
-	char *CommitPtr = getCommitPtr(CurSeg);
-	char *NewAllocPtr = AllocPtr + AlignedSize;
-	char *ReservePtr = getReservePtr(CurSeg);
-	if (NewAllocPtr > ReservePtr)
+	NumPendingDecommit = 0;
+}
+
+/* Sampling heap profiler.
+ * Allocations are sampled on average once every ProfileRate bytes, with the
+ * distance between samples drawn from an exponential distribution so that
+ * sampling is a Poisson process over allocated bytes (as in tcmalloc).
+ * Every sampled object gets the SAMPLED bit in its header and an entry in
+ * the Samples table; its allocation site (the stack trace at the mymalloc
+ * call) is interned in the Sites table.  myfree drops the entry, and every
+ * sweep ages the surviving samples.
+ */
+#define PROFILE_MAX_DEPTH 32
+
+typedef struct ProfileSite
+{
+	ulong64 Hash;
+	int Depth;
+	void *Frames[PROFILE_MAX_DEPTH];
+	/* estimated objects and bytes, unbiased by the sampling probability */
+	double AllocObjects;
+	double AllocBytes;
+	double LiveObjects;
+	double LiveBytes;
+	/* estimated live bytes summed over every collection they survived */
+	double SurvivedBytes;
+	struct ProfileSite *Next;
+} ProfileSite;
+
+typedef struct ProfileSample
+{
+	ObjHeader *Header;
+	double Weight;
+	unsigned Collections;
+	ProfileSite *Site;
+} ProfileSample;
+
+static size_t ProfileRate = 0;
+static long long BytesUntilSample = LLONG_MAX;
+static ulong64 ProfileRandom = 0;
+
+/* open-addressed with linear probing, keyed by the object header */
+static ProfileSample *Samples = NULL;
+static size_t SamplesCapacity = 0;
+static size_t NumSamples = 0;
+
+#define PROFILE_SITE_BUCKETS 4096
+static ProfileSite *Sites[PROFILE_SITE_BUCKETS];
+
+extern char safegc_trampolines_start[], safegc_trampolines_end[];
+
+static long long nextSampleInterval()
+{
+	/* xorshift64*, seeded lazily */
+	if (ProfileRandom == 0)
 	{
-		CurSeg = allocateSegment(1);
-		return BigAlloc(Size);
+		ProfileRandom = (ulong64)getTimeNs() ^ ((ulong64)getpid() << 32) ^ 0x9e3779b97f4a7c15ULL;
 	}
-	NumBytesAllocated += AlignedSize;
-	assert(AllocPtr == CommitPtr);
-	allowAccess(CommitPtr, AlignedSize);
-	setAllocPtr(CurSeg, NewAllocPtr);
-	setCommitPtr(CurSeg, NewAllocPtr);
+	ProfileRandom ^= ProfileRandom >> 12;
+	ProfileRandom ^= ProfileRandom << 25;
+	ProfileRandom ^= ProfileRandom >> 27;
+	ulong64 R = ProfileRandom * 0x2545f4914f6cdd1dULL;
+	/* uniform in (0, 1] */
+	double U = ((R >> 11) + 1) * (1.0 / 9007199254740992.0);
+	long long Interval = (long long)(-log(U) * ProfileRate);
+	return Interval > 0 ? Interval : 1;
+}
 
-	unsigned short *SzMeta = getSizeMetadata(AllocPtr);
-	SzMeta[0] = 1;
+static void retractAllocState();
+static void publishAllocState();
 
-	ObjHeader *Header = (ObjHeader *)AllocPtr;
-	Header->Size = AlignedSize;
-	Header->Status = 0;
-	Header->Type = 0;
-	return AllocPtr + OBJ_HEADER_SIZE;
+void gc_set_profile_rate(size_t MeanBytes)
+{
+	pthread_mutex_lock(&HeapLock);
+	retractAllocState();
+	ProfileRate = MeanBytes;
+	BytesUntilSample = ProfileRate ? nextSampleInterval() : LLONG_MAX;
+	publishAllocState();
+	pthread_mutex_unlock(&HeapLock);
 }
 
-void *_mymalloc(size_t Size)
+static ulong64 hashPointer(void *Ptr)
 {
-	size_t AlignedSize = Align(Size, 8) + OBJ_HEADER_SIZE;
+	ulong64 H = (ulong64)Ptr;
+	H ^= H >> 33;
+	H *= 0xff51afd7ed558ccdULL;
+	H ^= H >> 33;
+	return H;
+}
 
-	checkAndRunGC(AlignedSize);
-	if (AlignedSize > COMMIT_SIZE)
+static ProfileSite *internSite(void **Frames, int Depth)
+{
+	ulong64 Hash = 0;
+	int i;
+	for (i = 0; i < Depth; i++)
 	{
-		return BigAlloc(Size);
+		Hash = (Hash * 31) ^ hashPointer(Frames[i]);
 	}
-	assert(Size != 0);
-	assert(sizeof(struct OtherMetadata) <= OTHER_METADATA_SIZE);
-	assert(sizeof(struct Segment) == METADATA_SIZE);
+	ProfileSite **Bucket = &Sites[Hash % PROFILE_SITE_BUCKETS];
+	ProfileSite *Site;
+	for (Site = *Bucket; Site != NULL; Site = Site->Next)
+	{
+		if (Site->Hash == Hash && Site->Depth == Depth && !memcmp(Site->Frames, Frames, Depth * sizeof(void *)))
+		{
+			return Site;
+		}
+	}
+	Site = calloc(1, sizeof(ProfileSite));
+	if (Site == NULL)
+	{
+		printf("Unable to allocate profile site\n");
+		exit(0);
+	}
+	Site->Hash = Hash;
+	Site->Depth = Depth;
+	memcpy(Site->Frames, Frames, Depth * sizeof(void *));
+	Site->Next = *Bucket;
+	*Bucket = Site;
+	return Site;
+}
 
-	static Segment *CurSeg = NULL;
+static void insertSample(ProfileSample *Sample);
 
-	if (CurSeg == NULL)
+static void growSamples()
+{
+	ProfileSample *Old = Samples;
+	size_t OldCapacity = SamplesCapacity;
+	size_t i;
+
+	SamplesCapacity = SamplesCapacity ? SamplesCapacity * 2 : 1024;
+	Samples = calloc(SamplesCapacity, sizeof(ProfileSample));
+	if (Samples == NULL)
 	{
-		CurSeg = allocateSegment(0);
+		printf("Unable to allocate profile samples\n");
+		exit(0);
 	}
-	char *AllocPtr = getAllocPtr(CurSeg);
-	char *CommitPtr = getCommitPtr(CurSeg);
-	char *NewAllocPtr = AllocPtr + AlignedSize;
-	if (NewAllocPtr > CommitPtr)
+	NumSamples = 0;
+	for (i = 0; i < OldCapacity; i++)
 	{
-		if (AllocPtr != CommitPtr)
-		{
-			/* Free remaining space on this page */
-			createHole(CurSeg);
-		}
-		extendCommitSpace(CurSeg);
-		AllocPtr = getAllocPtr(CurSeg);
-		NewAllocPtr = AllocPtr + AlignedSize;
-		CommitPtr = getCommitPtr(CurSeg);
-		if (NewAllocPtr > CommitPtr)
+		if (Old[i].Header != NULL)
 		{
-			CurSeg = allocateSegment(0);
-			return _mymalloc(Size);
+			insertSample(&Old[i]);
 		}
 	}
+	free(Old);
+}
 
-	NumBytesAllocated += AlignedSize;
-	setAllocPtr(CurSeg, NewAllocPtr);
-	ObjHeader *Header = (ObjHeader *)AllocPtr;
-	Header->Size = AlignedSize;
-	Header->Status = 0;
-	Header->Type = 0;
-	return AllocPtr + OBJ_HEADER_SIZE;
+static void insertSample(ProfileSample *Sample)
+{
+	if ((NumSamples + 1) * 4 > SamplesCapacity * 3)
+	{
+		growSamples();
+	}
+	size_t Mask = SamplesCapacity - 1;
+	size_t Idx = hashPointer(Sample->Header) & Mask;
+	while (Samples[Idx].Header != NULL)
+	{
+		Idx = (Idx + 1) & Mask;
+	}
+	Samples[Idx] = *Sample;
+	NumSamples++;
 }
 
-// retrieveObjectHeader is a helper function that retrieves the object header for the 8-byte object at the address.
-// The function takes w (the 8-byte value), the segment in which the object lies and a flag to check if the object is a big allocation.
-static char *retrieveObjectHeader(int isBigAlloc, char *W, Segment *foundSegment)
+/* record a stack trace for the object that has just been allocated */
+static void sampleAllocation(ObjHeader *Header)
 {
-	// Get the metadata for the page to which the object belongs.
-	unsigned short *sizeMetadata = getSizeMetadata(W);
+	void *Frames[PROFILE_MAX_DEPTH + 8];
+	int Depth = backtrace(Frames, PROFILE_MAX_DEPTH + 8);
+	int First = 0;
+	int i;
 
-	// Check if the page has been allocated or not.
-	// Check if the object is freed or not.
-	if (sizeMetadata[0] == PAGE_SIZE)
+	/* drop the collector's own frames, up to and including the mymalloc trampoline */
+	for (i = 0; i < Depth; i++)
 	{
-		// The page is free.
-		// This means that the object is not a valid object.
-		return NULL;
+		if ((char *)Frames[i] > safegc_trampolines_start && (char *)Frames[i] <= safegc_trampolines_end)
+		{
+			First = i + 1;
+			break;
+		}
+	}
+	Depth -= First;
+	if (Depth > PROFILE_MAX_DEPTH)
+	{
+		Depth = PROFILE_MAX_DEPTH;
 	}
 
-	// Taken from getSizeMetadata, refer to the function for more details.
-	char *pageForObject = ADDR_TO_PAGE(W);
-	ulong64 pageNoForObject = (pageForObject - (char *)foundSegment) / PAGE_SIZE;
+	ProfileSample Sample;
+	Sample.Header = Header;
+	Sample.Weight = 1.0 / (1.0 - exp(-(double)Header->Size / ProfileRate));
+	Sample.Collections = 0;
+	Sample.Site = internSite(Frames + First, Depth);
+	Sample.Site->AllocObjects += Sample.Weight;
+	Sample.Site->AllocBytes += Sample.Weight * Header->Size;
+	Sample.Site->LiveObjects += Sample.Weight;
+	Sample.Site->LiveBytes += Sample.Weight * Header->Size;
+	insertSample(&Sample);
+	Header->Status |= SAMPLED;
+}
 
-	// Check if the allocation is a big allocation.
-	if (isBigAlloc == 0)
+static inline void maybeSampleAllocation(ObjHeader *Header)
+{
+	BytesUntilSample -= Header->Size;
+	if (BytesUntilSample <= 0)
 	{
-		// The object is not a big allocation.
-		// Iterate through all the objects in this page.
-		// Check if the object is the object we are looking for.
-		char *currentObject = pageForObject;
-		ObjHeader *currentObjectHeader = (ObjHeader *)pageForObject;
-		// We check two conditions:
-		// 1. The value lies between the address of the object and the address of the object + size of the object.
-		// 2. The pointer to the object is less than the address of the page + PAGE_SIZE.
-		// When these two conditions are met, this means that the object is the object we are looking for.
-		char *endAddress = currentObject + currentObjectHeader->Size;
-		char *startAddress = currentObject + OBJ_HEADER_SIZE;
-		char *pageBounds = pageForObject + PAGE_SIZE;
-		int withinPageBounds = 0;
-		int withinObjectBounds = 0;
+		BytesUntilSample = nextSampleInterval();
+		sampleAllocation(Header);
+	}
+}
 
-		if (W <= endAddress && W >= startAddress)
+/* called by myfree for objects carrying the SAMPLED bit */
+static void unsampleObject(ObjHeader *Header)
+{
+	size_t Mask = SamplesCapacity - 1;
+	size_t Idx = hashPointer(Header) & Mask;
+	while (Samples[Idx].Header != Header)
+	{
+		assert(Samples[Idx].Header != NULL);
+		Idx = (Idx + 1) & Mask;
+	}
+	ProfileSite *Site = Samples[Idx].Site;
+	Site->LiveObjects -= Samples[Idx].Weight;
+	Site->LiveBytes -= Samples[Idx].Weight * Header->Size;
+
+	/* backward-shift deletion keeps probe sequences intact without tombstones */
+	size_t Hole = Idx;
+	for (Idx = (Idx + 1) & Mask; Samples[Idx].Header != NULL; Idx = (Idx + 1) & Mask)
+	{
+		size_t Home = hashPointer(Samples[Idx].Header) & Mask;
+		if (((Idx - Home) & Mask) >= ((Idx - Hole) & Mask))
 		{
-			withinObjectBounds = 1;
+			Samples[Hole] = Samples[Idx];
+			Hole = Idx;
 		}
+	}
+	Samples[Hole].Header = NULL;
+	NumSamples--;
+}
 
-		if (W <= pageBounds)
+/* called after every sweep: the remaining samples survived one more collection */
+static void ageSamples()
+{
+	size_t i;
+	for (i = 0; i < SamplesCapacity; i++)
+	{
+		if (Samples[i].Header != NULL)
 		{
-			withinPageBounds = 1;
+			Samples[i].Collections++;
+			Samples[i].Site->SurvivedBytes += Samples[i].Weight * Samples[i].Header->Size;
 		}
+	}
+}
+
+static void writeFrame(FILE *Out, void *Frame)
+{
+	Dl_info Info;
+	int Found = dladdr(Frame, &Info);
+	if (Found && Info.dli_sname != NULL)
+	{
+		fprintf(Out, "%s", Info.dli_sname);
+	}
+	else if (Found && Info.dli_fname != NULL)
+	{
+		const char *Module = strrchr(Info.dli_fname, '/');
+		fprintf(Out, "%s+0x%lx", Module ? Module + 1 : Info.dli_fname,
+				(unsigned long)((char *)Frame - (char *)Info.dli_fbase));
+	}
+	else
+	{
+		fprintf(Out, "%p", Frame);
+	}
+}
+
+/* one line per site: caller frames outermost first, then the estimated live bytes */
+static void writeFolded(FILE *Out)
+{
+	int b, i;
+	ProfileSite *Site;
+	for (b = 0; b < PROFILE_SITE_BUCKETS; b++)
+	{
+		for (Site = Sites[b]; Site != NULL; Site = Site->Next)
+		{
+			if (Site->LiveBytes < 1)
+			{
+				continue;
+			}
+			for (i = Site->Depth - 1; i >= 0; i--)
+			{
+				writeFrame(Out, Site->Frames[i]);
+				fputc(i ? ';' : ' ', Out);
+			}
+			if (Site->Depth == 0)
+			{
+				fputs("[unknown] ", Out);
+			}
+			fprintf(Out, "%.0f\n", Site->LiveBytes);
+		}
+	}
+}
+
+/* the legacy gperftools heap profile format, which pprof reads directly */
+static void writePprof(FILE *Out)
+{
+	double LiveObjects = 0, LiveBytes = 0, AllocObjects = 0, AllocBytes = 0;
+	int b, i;
+	ProfileSite *Site;
+
+	for (b = 0; b < PROFILE_SITE_BUCKETS; b++)
+	{
+		for (Site = Sites[b]; Site != NULL; Site = Site->Next)
+		{
+			LiveObjects += Site->LiveObjects;
+			LiveBytes += Site->LiveBytes;
+			AllocObjects += Site->AllocObjects;
+			AllocBytes += Site->AllocBytes;
+		}
+	}
+	fprintf(Out, "heap profile: %.0f: %.0f [%.0f: %.0f] @ heap_v2/%zu\n",
+			LiveObjects, LiveBytes, AllocObjects, AllocBytes, ProfileRate);
+	for (b = 0; b < PROFILE_SITE_BUCKETS; b++)
+	{
+		for (Site = Sites[b]; Site != NULL; Site = Site->Next)
+		{
+			fprintf(Out, "%.0f: %.0f [%.0f: %.0f] @", Site->LiveObjects, Site->LiveBytes,
+					Site->AllocObjects, Site->AllocBytes);
+			for (i = 0; i < Site->Depth; i++)
+			{
+				fprintf(Out, " %p", Site->Frames[i]);
+			}
+			fputc('\n', Out);
+		}
+	}
+
+	fprintf(Out, "\nMAPPED_LIBRARIES:\n");
+	FILE *Maps = fopen("/proc/self/maps", "r");
+	if (Maps != NULL)
+	{
+		char Line[512];
+		while (fgets(Line, sizeof(Line), Maps) != NULL)
+		{
+			fputs(Line, Out);
+		}
+		fclose(Maps);
+	}
+}
+
+static int compareSitesByLiveBytes(const void *A, const void *B)
+{
+	double X = (*(ProfileSite *const *)A)->LiveBytes;
+	double Y = (*(ProfileSite *const *)B)->LiveBytes;
+	return (X < Y) - (X > Y);
+}
+
+/* live heap broken down by size class and by allocation site */
+static void writeCensus(FILE *Out)
+{
+	/* class c holds objects of [2^(c+3), 2^(c+4)) bytes, headers included */
+	double ClassObjects[40] = {0}, ClassBytes[40] = {0};
+	size_t i;
+	int c;
+
+	for (i = 0; i < SamplesCapacity; i++)
+	{
+		if (Samples[i].Header == NULL)
+		{
+			continue;
+		}
+		unsigned Size = Samples[i].Header->Size;
+		for (c = 0; c < 39 && (Size >> (c + 4)) != 0; c++)
+			;
+		ClassObjects[c] += Samples[i].Weight;
+		ClassBytes[c] += Samples[i].Weight * Size;
+	}
+
+	fprintf(Out, "# heap census, sampling every %zu bytes, %zu live samples\n", ProfileRate, NumSamples);
+	fprintf(Out, "# size class\tobjects\tbytes\n");
+	for (c = 0; c < 40; c++)
+	{
+		if (ClassObjects[c] >= 0.5)
+		{
+			fprintf(Out, "%llu-%llu\t%.0f\t%.0f\n", 1ULL << (c + 3), (1ULL << (c + 4)) - 1,
+					ClassObjects[c], ClassBytes[c]);
+		}
+	}
+
+	size_t NumSites = 0, Cur = 0;
+	int b;
+	ProfileSite *Site;
+	for (b = 0; b < PROFILE_SITE_BUCKETS; b++)
+	{
+		for (Site = Sites[b]; Site != NULL; Site = Site->Next)
+		{
+			NumSites++;
+		}
+	}
+	ProfileSite **Sorted = malloc((NumSites + 1) * sizeof(ProfileSite *));
+	if (Sorted == NULL)
+	{
+		return;
+	}
+	for (b = 0; b < PROFILE_SITE_BUCKETS; b++)
+	{
+		for (Site = Sites[b]; Site != NULL; Site = Site->Next)
+		{
+			Sorted[Cur++] = Site;
+		}
+	}
+	qsort(Sorted, NumSites, sizeof(ProfileSite *), compareSitesByLiveBytes);
+
+	fprintf(Out, "# live objects\tlive bytes\tallocated bytes\tbyte-collections survived\tsite\n");
+	for (Cur = 0; Cur < NumSites; Cur++)
+	{
+		Site = Sorted[Cur];
+		fprintf(Out, "%.0f\t%.0f\t%.0f\t%.0f\t", Site->LiveObjects, Site->LiveBytes, Site->AllocBytes,
+				Site->SurvivedBytes);
+		for (c = 0; c < Site->Depth; c++)
+		{
+			if (c)
+			{
+				fputs(" <- ", Out);
+			}
+			writeFrame(Out, Site->Frames[c]);
+		}
+		fputc('\n', Out);
+	}
+	free(Sorted);
+}
+
+int gc_heap_profile_dump(const char *Path, enum gc_profile_format Format)
+{
+	FILE *Out = fopen(Path, "w");
+	if (Out == NULL)
+	{
+		return -1;
+	}
+	switch (Format)
+	{
+	case GC_PROFILE_FOLDED:
+		writeFolded(Out);
+		break;
+	case GC_PROFILE_PPROF:
+		writePprof(Out);
+		break;
+	case GC_PROFILE_CENSUS:
+		writeCensus(Out);
+		break;
+	}
+	fclose(Out);
+	return 0;
+}
+
+/* Fold the allocations made inline by gc_malloc back into the library's
+ * state.  Every library entry point calls this before it looks at the small
+ * segment's alloc pointer or at the allocation counters.
+ */
+static void retractAllocState()
+{
+	long long Used = BudgetGranted - gc_alloc_state.budget;
+	if (Used == 0)
+	{
+		return;
+	}
+	setAllocPtr(SmallSeg, gc_alloc_state.alloc_ptr);
+	NumBytesAllocated += Used;
+	AllocSinceGC += Used;
+	BytesUntilSample -= Used;
+	BudgetGranted = gc_alloc_state.budget;
+}
+
+/* Hand the current page and a new budget to the inline fast path.  The budget
+ * stops short of the next collection and the next profiler sample, so the
+ * allocation that reaches either one takes the slow path.
+ */
+static void publishAllocState()
+{
+	if (SmallSeg == NULL)
+	{
+		return;
+	}
+	long long Budget = gcTrigger() - AllocSinceGC - 1;
+	if (BytesUntilSample - 1 < Budget)
+	{
+		Budget = BytesUntilSample - 1;
+	}
+	if (Budget < 0 || TraceFd >= 0)
+	{
+		Budget = 0;
+	}
+	gc_alloc_state.alloc_ptr = getAllocPtr(SmallSeg);
+	gc_alloc_state.limit = getCommitPtr(SmallSeg);
+	gc_alloc_state.budget = Budget;
+	BudgetGranted = Budget;
+}
+
+/* used by the GC to free objects. */
+static void myfree(void *Ptr)
+{
+	ObjHeader *Header = (ObjHeader *)((char *)Ptr - OBJ_HEADER_SIZE);
+	assert((Header->Status & FREE) == 0);
+	NumBytesFreed += Header->Size;
+	if (Header->Status & SAMPLED)
+	{
+		unsampleObject(Header);
+	}
+	if (Header->Size > COMMIT_SIZE)
+	{
+		assert((Header->Size % PAGE_SIZE) == 0);
+		assert(((ulong64)Header & (PAGE_SIZE - 1)) == 0);
+		/* only the first page of the span changes; its length stays in the span entry */
+		unsigned short *SzMeta = getSizeMetadata((char *)Header);
+		SzMeta[0] = PAGE_SIZE;
+		Header->Status = FREE;
+		releasePages(Header, Header->Size);
+		return;
+	}
+
+	unsigned short *SzMeta = getSizeMetadata((char *)Header);
+	SzMeta[0] += Header->Size;
+	assert(SzMeta[0] <= PAGE_SIZE);
+	Header->Status = FREE;
+	if (SzMeta[0] == PAGE_SIZE)
+	{
+		char *Page = ADDR_TO_PAGE(Ptr);
+		releasePages(Page, PAGE_SIZE);
+	}
+}
+
+/* Take a span of AlignedSize bytes, a multiple of PAGE_SIZE, from the big
+ * segment and set up its page metadata; returns NULL if the heap cannot grow.
+ */
+static char *allocateSpan(size_t AlignedSize)
+{
+	assert(AlignedSize <= MAX_ALLOC_SIZE);
+	Segment *CurSeg = BigSeg;
+	if (CurSeg == NULL)
+	{
+		CurSeg = BigSeg = allocateSegment(1);
+		if (CurSeg == NULL)
+		{
+			return NULL;
+		}
+	}
+	char *AllocPtr = getAllocPtr(CurSeg);
+	char *CommitPtr = getCommitPtr(CurSeg);
+	char *NewAllocPtr = AllocPtr + AlignedSize;
+	char *ReservePtr = getReservePtr(CurSeg);
+	if (NewAllocPtr > ReservePtr)
+	{
+		BigSeg = NULL;
+		return allocateSpan(AlignedSize);
+	}
+	assert(AllocPtr == CommitPtr);
+	if (allowAccess(CommitPtr, AlignedSize) != 0)
+	{
+		return NULL;
+	}
+	NumBytesAllocated += AlignedSize;
+	setAllocPtr(CurSeg, NewAllocPtr);
+	setCommitPtr(CurSeg, NewAllocPtr);
+
+	unsigned short *SzMeta = getSizeMetadata(AllocPtr);
+	SzMeta[0] = 1;
+	unsigned *SpanMeta = getSpanMetadata(AllocPtr);
+	unsigned NumPages = AlignedSize / PAGE_SIZE;
+	unsigned Iter;
+	SpanMeta[0] = NumPages;
+	for (Iter = 1; Iter < NumPages; Iter++)
+	{
+		SpanMeta[Iter] = Iter;
+	}
+	return AllocPtr;
+}
+
+/* returns NULL if the heap cannot grow */
+static void *BigAlloc(size_t Size)
+{
+	size_t AlignedSize = Align(Size + OBJ_HEADER_SIZE, PAGE_SIZE);
+	char *AllocPtr = allocateSpan(AlignedSize);
+	if (AllocPtr == NULL)
+	{
+		return NULL;
+	}
+
+	ObjHeader *Header = (ObjHeader *)AllocPtr;
+	Header->Size = AlignedSize;
+	Header->Status = 0;
+	Header->Type = 0;
+	maybeSampleAllocation(Header);
+	return AllocPtr + OBJ_HEADER_SIZE;
+}
+
+/* Take AlignedSize bytes from the small segment being filled, moving to the
+ * next page or segment if they do not fit; returns NULL if the heap cannot grow.
+ */
+static char *allocateSmall(size_t AlignedSize)
+{
+	assert(sizeof(struct OtherMetadata) <= OTHER_METADATA_SIZE);
+	assert(sizeof(struct Segment) == METADATA_SIZE);
+
+	Segment *CurSeg = SmallSeg;
+
+	if (CurSeg == NULL)
+	{
+		CurSeg = SmallSeg = allocateSegment(0);
+		if (CurSeg == NULL)
+		{
+			return NULL;
+		}
+	}
+	char *AllocPtr = getAllocPtr(CurSeg);
+	char *CommitPtr = getCommitPtr(CurSeg);
+	char *NewAllocPtr = AllocPtr + AlignedSize;
+	if (NewAllocPtr > CommitPtr)
+	{
+		if (AllocPtr != CommitPtr)
+		{
+			/* Free remaining space on this page */
+			createHole(CurSeg);
+		}
+		if (extendCommitSpace(CurSeg) != 0)
+		{
+			return NULL;
+		}
+		AllocPtr = getAllocPtr(CurSeg);
+		NewAllocPtr = AllocPtr + AlignedSize;
+		CommitPtr = getCommitPtr(CurSeg);
+		if (NewAllocPtr > CommitPtr)
+		{
+			Segment *NewSeg = allocateSegment(0);
+			if (NewSeg == NULL)
+			{
+				return NULL;
+			}
+			SmallSeg = NewSeg;
+			return allocateSmall(AlignedSize);
+		}
+	}
+	setAllocPtr(CurSeg, NewAllocPtr);
+	return AllocPtr;
+}
+
+/* returns NULL if the heap cannot grow */
+static void *smallAlloc(size_t Size, size_t AlignedSize)
+{
+	assert(Size != 0);
+	char *AllocPtr = allocateSmall(AlignedSize);
+	if (AllocPtr == NULL)
+	{
+		return NULL;
+	}
+
+	NumBytesAllocated += AlignedSize;
+	ObjHeader *Header = (ObjHeader *)AllocPtr;
+	Header->Size = AlignedSize;
+	Header->Status = 0;
+	Header->Type = 0;
+	maybeSampleAllocation(Header);
+	return AllocPtr + OBJ_HEADER_SIZE;
+}
+
+/* Heap limits.
+ * The heap is measured in committed bytes, metadata included.  An allocation
+ * that would take the heap past the soft limit first runs a full collection,
+ * which also decommits the pages it frees, unless the trigger has just run
+ * one for it; the heap then grows past the limit if it has to, and the next
+ * crossing is only checked once it is back below.
+ * An allocation that would take it past the hard limit gets one last
+ * collection, and if that does not make room it fails: mymalloc returns what
+ * the out-of-memory handler returns, or NULL without one.
+ */
+static size_t SoftLimit = 0;
+static size_t HardLimit = 0;
+static int OverSoftLimit = 0;
+static gc_oom_handler OomHandler = NULL;
+
+static void collectAllGarbage();
+
+void gc_set_heap_limits(size_t Soft, size_t Hard)
+{
+	pthread_mutex_lock(&HeapLock);
+	SoftLimit = Soft;
+	HardLimit = Hard;
+	OverSoftLimit = 0;
+	pthread_mutex_unlock(&HeapLock);
+}
+
+void gc_set_oom_handler(gc_oom_handler Handler)
+{
+	pthread_mutex_lock(&HeapLock);
+	OomHandler = Handler;
+	pthread_mutex_unlock(&HeapLock);
+}
+
+/* bytes the heap has to commit to satisfy an allocation of AlignedSize */
+static size_t heapGrowth(size_t Size, size_t AlignedSize)
+{
+	if (AlignedSize > COMMIT_SIZE)
+	{
+		size_t SpanSize = Align(Size + OBJ_HEADER_SIZE, PAGE_SIZE);
+		if (BigSeg == NULL || getAllocPtr(BigSeg) + SpanSize > getReservePtr(BigSeg))
+		{
+			return SpanSize + METADATA_SIZE + SPAN_METADATA_SIZE;
+		}
+		return SpanSize;
+	}
+	if (SmallSeg == NULL)
+	{
+		return COMMIT_SIZE + METADATA_SIZE;
+	}
+	if (getAllocPtr(SmallSeg) + AlignedSize <= getCommitPtr(SmallSeg))
+	{
+		return 0;
+	}
+	if (getCommitPtr(SmallSeg) + COMMIT_SIZE > getReservePtr(SmallSeg))
+	{
+		return COMMIT_SIZE + METADATA_SIZE;
+	}
+	return COMMIT_SIZE;
+}
+
+/* Returns -1 if the allocation must fail because of the hard limit.
+ * JustCollected says the trigger already ran a collection for this
+ * allocation, so crossing the soft limit does not run another one.
+ */
+static int checkHeapLimits(size_t Size, size_t AlignedSize, int JustCollected)
+{
+	int Collected = 0;
+	size_t Growth = heapGrowth(Size, AlignedSize);
+	if (Growth == 0)
+	{
+		return 0;
+	}
+	if (SoftLimit != 0)
+	{
+		if (Stats.committed_bytes <= SoftLimit)
+		{
+			OverSoftLimit = 0;
+		}
+		if (!OverSoftLimit && Stats.committed_bytes + Growth > SoftLimit)
+		{
+			if (!JustCollected)
+			{
+				collectAllGarbage();
+				Collected = 1;
+				Growth = heapGrowth(Size, AlignedSize);
+			}
+			OverSoftLimit = Stats.committed_bytes + Growth > SoftLimit;
+		}
+	}
+	if (HardLimit != 0 && Stats.committed_bytes + Growth > HardLimit)
+	{
+		if (!Collected)
+		{
+			collectAllGarbage();
+			Growth = heapGrowth(Size, AlignedSize);
+		}
+		if (Stats.committed_bytes + Growth > HardLimit)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* called without HeapLock, since the handler may allocate */
+static void *outOfMemory(size_t Size)
+{
+	pthread_mutex_lock(&HeapLock);
+	gc_oom_handler Handler = OomHandler;
+	pthread_mutex_unlock(&HeapLock);
+	if (Handler != NULL)
+	{
+		return Handler(Size);
+	}
+	return NULL;
+}
+
+/* allocate Size bytes and add Status and Type to the object's header; returns NULL on failure */
+static void *allocateObject(size_t Size, unsigned Status, ulong64 Type)
+{
+	if (Size > MAX_ALLOC_SIZE - OBJ_HEADER_SIZE - PAGE_SIZE)
+	{
+		return NULL;
+	}
+	size_t AlignedSize = Align(Size, 8) + OBJ_HEADER_SIZE;
+	void *Ptr;
+
+	pthread_mutex_lock(&HeapLock);
+	retractAllocState();
+	long long Collections = NumGCTriggered;
+	checkAndRunGC(AlignedSize);
+	if (checkHeapLimits(Size, AlignedSize, NumGCTriggered != Collections) != 0)
+	{
+		Ptr = NULL;
+	}
+	else if (AlignedSize > COMMIT_SIZE)
+	{
+		Ptr = BigAlloc(Size);
+	}
+	else
+	{
+		Ptr = smallAlloc(Size, AlignedSize);
+	}
+	if (Ptr != NULL)
+	{
+		ObjHeader *Header = (ObjHeader *)((char *)Ptr - OBJ_HEADER_SIZE);
+		Header->Status |= Status;
+		Header->Type = Type;
+		traceEvent(GC_TRACE_ALLOC, (unsigned long long)Ptr, Size);
+	}
+	publishAllocState();
+	pthread_mutex_unlock(&HeapLock);
+	return Ptr;
+}
+
+/* the slow path of every allocation, entered through the mymalloc trampoline */
+void *_mymalloc(size_t Size)
+{
+	void *Ptr = allocateObject(Size, 0, 0);
+	if (Ptr == NULL)
+	{
+		return outOfMemory(Size);
+	}
+	return Ptr;
+}
+
+/* the slow path of allocations the scanner skips, entered through the mymalloc_atomic trampoline */
+void *_mymalloc_atomic(size_t Size)
+{
+	void *Ptr = allocateObject(Size, NOSCAN, 0);
+	if (Ptr == NULL)
+	{
+		return outOfMemory(Size);
+	}
+	return Ptr;
+}
+
+/* the slow path of typed allocations, entered through the mymalloc_typed trampoline */
+void *_mymalloc_typed(size_t Size, gc_layout Layout)
+{
+	/* a longer period than the bitmap covers would leave pointer words unscanned */
+	assert(GC_LAYOUT_WORDS(Layout) <= GC_LAYOUT_MAX_WORDS);
+	void *Ptr = allocateObject(Size, TYPED, Layout);
+	if (Ptr == NULL)
+	{
+		return outOfMemory(Size);
+	}
+	return Ptr;
+}
+
+/* Arenas.
+ * An arena allocates objects by bumping a pointer through chunks, which are
+ * big-segment spans whose header has the ARENA bit.  Arena objects have no
+ * headers of their own: to the collector a chunk is one big object whose
+ * size covers the part in use, so a pointer to any of its objects marks the
+ * chunk and the scan goes through all of them at once.  The first two words
+ * of every chunk link it to the chunks allocated before and after it, so
+ * marking one chunk marks the whole arena.  gc_arena_release frees all of
+ * them, span by span, without looking at the objects inside.  An arena
+ * whose objects all became unreachable before it was released is left
+ * unmarked as a whole; the sweep frees its chunks one by one and, through
+ * the gc_arena that each chunk's Type points to, empties the arena, so its
+ * next allocation starts a new chunk.
+ */
+#define ARENA_CHUNK_SIZE (64 << 10)
+#define ARENA_LINKS (2 * sizeof(char *))
+
+struct gc_arena
+{
+	ObjHeader *First;	/* the oldest chunk */
+	ObjHeader *Current; /* the chunk being filled */
+	char *Ptr;			/* the next free byte of Current */
+	char *Limit;		/* the end of Current */
+	size_t ChunkSize;
+};
+
+gc_arena *gc_arena_create(size_t ChunkSize)
+{
+	gc_arena *Arena = calloc(1, sizeof(gc_arena));
+	if (Arena == NULL)
+	{
+		printf("Unable to allocate arena\n");
+		exit(0);
+	}
+	ChunkSize = Align(ChunkSize ? ChunkSize : ARENA_CHUNK_SIZE, PAGE_SIZE);
+	/* a chunk must be bigger than a page to be allocated as a span */
+	Arena->ChunkSize = ChunkSize > PAGE_SIZE ? ChunkSize : 2 * PAGE_SIZE;
+	return Arena;
+}
+
+/* start a chunk big enough for AlignedSize bytes and allocate them from it */
+static void *newArenaChunk(gc_arena *Arena, size_t AlignedSize)
+{
+	size_t ChunkBytes = Align(OBJ_HEADER_SIZE + ARENA_LINKS + AlignedSize, PAGE_SIZE);
+	char *Span = NULL;
+
+	if (ChunkBytes < Arena->ChunkSize)
+	{
+		ChunkBytes = Arena->ChunkSize;
+	}
+	retractAllocState();
+	long long Collections = NumGCTriggered;
+	checkAndRunGC(ChunkBytes);
+	if (checkHeapLimits(ChunkBytes - OBJ_HEADER_SIZE, ChunkBytes, NumGCTriggered != Collections) == 0)
+	{
+		Span = allocateSpan(ChunkBytes);
+	}
+	publishAllocState();
+	if (Span == NULL)
+	{
+		return NULL;
+	}
+
+	ObjHeader *Header = (ObjHeader *)Span;
+	char **Links = (char **)(Span + OBJ_HEADER_SIZE);
+	Header->Status = ARENA;
+	Header->Type = (ulong64)Arena;
+	Links[1] = NULL;
+	Arena->Ptr = (char *)Links + ARENA_LINKS + AlignedSize;
+	Arena->Limit = Span + ChunkBytes;
+	/* the marker thread may reach the chunk through the link as soon as it is stored */
+	__atomic_store_n(&Header->Size, (unsigned)(Arena->Ptr - Span), __ATOMIC_RELEASE);
+	if (Arena->Current != NULL)
+	{
+		char **PrevLinks = (char **)((char *)Arena->Current + OBJ_HEADER_SIZE);
+		Links[0] = (char *)PrevLinks;
+		__atomic_store_n(&PrevLinks[1], (char *)Links, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		Links[0] = NULL;
+		Arena->First = Header;
+	}
+	Arena->Current = Header;
+	traceEvent(GC_TRACE_ALLOC, (unsigned long long)Links, ChunkBytes - OBJ_HEADER_SIZE);
+	return (char *)Links + ARENA_LINKS;
+}
+
+/* entered through the gc_arena_alloc trampoline, since a new chunk may start a collection */
+void *_gc_arena_alloc(gc_arena *Arena, size_t Size)
+{
+	size_t AlignedSize = Align(Size ? Size : 1, 8);
+	char *Ptr = Arena->Ptr;
+	if (AlignedSize <= (size_t)(Arena->Limit - Ptr))
+	{
+		Arena->Ptr = Ptr + AlignedSize;
+		/* read by the marker thread, which does not take HeapLock */
+		__atomic_store_n(&Arena->Current->Size, (unsigned)(Arena->Ptr - (char *)Arena->Current), __ATOMIC_RELEASE);
+		return Ptr;
+	}
+	if (Size > MAX_ALLOC_SIZE - OBJ_HEADER_SIZE - ARENA_LINKS - PAGE_SIZE)
+	{
+		return outOfMemory(Size);
+	}
+	pthread_mutex_lock(&HeapLock);
+	Ptr = newArenaChunk(Arena, AlignedSize);
+	pthread_mutex_unlock(&HeapLock);
+	if (Ptr == NULL)
+	{
+		return outOfMemory(Size);
+	}
+	return Ptr;
+}
+
+/* return the span of an arena chunk to the big segment */
+static void freeArenaChunk(ObjHeader *Chunk)
+{
+	size_t SpanSize = (size_t)getSpanMetadata((char *)Chunk)[0] * PAGE_SIZE;
+
+	traceEvent(GC_TRACE_FREE, (unsigned long long)Chunk + OBJ_HEADER_SIZE, SpanSize);
+	NumBytesFreed += SpanSize;
+	getSizeMetadata((char *)Chunk)[0] = PAGE_SIZE;
+	Chunk->Status = FREE;
+	releasePages(Chunk, SpanSize);
+}
+
+/* called by the sweep for an unmarked chunk: the whole arena is unreachable */
+static void sweepArenaChunk(ObjHeader *Chunk)
+{
+	gc_arena *Arena = (gc_arena *)Chunk->Type;
+	Arena->First = NULL;
+	Arena->Current = NULL;
+	Arena->Ptr = NULL;
+	Arena->Limit = NULL;
+	freeArenaChunk(Chunk);
+}
+
+void gc_arena_release(gc_arena *Arena)
+{
+	ObjHeader *Chunk = Arena->First;
+
+	pthread_mutex_lock(&HeapLock);
+	while (Chunk != NULL)
+	{
+		char **Links = (char **)((char *)Chunk + OBJ_HEADER_SIZE);
+		ObjHeader *Next = Links[1] ? (ObjHeader *)(Links[1] - OBJ_HEADER_SIZE) : NULL;
+		freeArenaChunk(Chunk);
+		Chunk = Next;
+	}
+	pthread_mutex_unlock(&HeapLock);
+	free(Arena);
+}
+
+// retrieveObjectHeader is a helper function that retrieves the object header for the 8-byte object at the address.
+// The function takes w (the 8-byte value), the segment in which the object lies and a flag to check if the object is a big allocation.
+static char *retrieveObjectHeader(int isBigAlloc, char *W, Segment *foundSegment)
+{
+	// Get the metadata for the page to which the object belongs.
+	unsigned short *sizeMetadata = getSizeMetadata(W);
+
+	// Check if the page has been allocated or not.
+	// Check if the object is freed or not.
+	if (sizeMetadata[0] == PAGE_SIZE)
+	{
+		// The page is free.
+		// This means that the object is not a valid object.
+		return NULL;
+	}
+
+	// Taken from getSizeMetadata, refer to the function for more details.
+	char *pageForObject = ADDR_TO_PAGE(W);
+	ulong64 pageNoForObject = (pageForObject - (char *)foundSegment) / PAGE_SIZE;
+
+	// Check if the allocation is a big allocation.
+	if (isBigAlloc == 0)
+	{
+		// The object is not a big allocation.
+		// Iterate through all the objects in this page.
+		// Check if the object is the object we are looking for.
+		char *currentObject = pageForObject;
+		ObjHeader *currentObjectHeader = (ObjHeader *)pageForObject;
+		// We check two conditions:
+		// 1. The value lies between the address of the object and the address of the object + size of the object.
+		// 2. The pointer to the object is less than the address of the page + PAGE_SIZE.
+		// When these two conditions are met, this means that the object is the object we are looking for.
+		char *endAddress = currentObject + currentObjectHeader->Size;
+		char *startAddress = currentObject + OBJ_HEADER_SIZE;
+		char *pageBounds = pageForObject + PAGE_SIZE;
+		int withinPageBounds = 0;
+		int withinObjectBounds = 0;
+
+		if (W <= endAddress && W >= startAddress)
+		{
+			withinObjectBounds = 1;
+		}
+
+		if (W <= pageBounds)
+		{
+			withinPageBounds = 1;
+		}
+
+		while (!(withinObjectBounds == 1) && (withinPageBounds == 1))
+		{
+			currentObject = currentObject + currentObjectHeader->Size;
+			currentObjectHeader = (ObjHeader *)currentObject;
+			endAddress = currentObject + currentObjectHeader->Size;
+			startAddress = currentObject + OBJ_HEADER_SIZE;
+			pageBounds = pageForObject + PAGE_SIZE;
+
+			if (W <= endAddress && W >= startAddress)
+			{
+				withinObjectBounds = 1;
+			}
+			else
+			{
+				withinObjectBounds = 0;
+			}
+
+			if (W <= pageBounds)
+			{
+				withinPageBounds = 1;
+			}
+			else
+			{
+				withinPageBounds = 0;
+			}
+		}
+		return currentObject;
+	}
+	else
+	{
+		// The object is a big allocation.
+		// Interior pages record how far back the first page of their span is.
+		if (sizeMetadata[0] == 0)
+		{
+			unsigned *spanMetadata = getSpanMetadata(W);
+			pageNoForObject -= spanMetadata[0];
+			pageForObject -= (ulong64)spanMetadata[0] * PAGE_SIZE;
+		}
+		// The span may have been freed, or merged into a free span by the sweep.
+		if (foundSegment->Size[pageNoForObject] != 1)
+		{
+			return NULL;
+		}
+		return pageForObject;
+	}
+}
+
+// findSegment returns the segment whose allocated range [data pointer, alloc pointer)
+// contains W, or NULL if W does not point into the heap.
+// The alloc pointer itself is excluded: when it sits on a page boundary, the page
+// it points to has not been committed yet and has no object headers to walk.
+static Segment *findSegment(char *W)
+{
+	// Keeping track of the iterator for the current segment.
+	// This is used to iterate through all the segments.
+	SegmentList *L = Segments;
+
+	// Iterating over all the segments to check if the 8-byte values stored at the pointer address
+	// lies between the data pointer and the alloc pointer of the segment.
+	while (L != NULL)
+	{
+		Segment *curSeg = L->Segment;
+		char *dataPtr = getDataPtr(curSeg);
+		char *allocPtr = getAllocPtr(curSeg);
+
+		if (dataPtr <= W && W < allocPtr)
+		{
+			return curSeg;
+		}
+		L = L->Next;
+	}
+	return NULL;
+}
+
+static void computeHeapBounds()
+{
+	SegmentList *L;
+	HeapLow = (char *)-1;
+	HeapHigh = NULL;
+	NumHeapSegs = 0;
+	for (L = Segments; L != NULL; L = L->Next)
+	{
+		if (NumHeapSegs == MaxHeapSegs)
+		{
+			MaxHeapSegs = MaxHeapSegs ? MaxHeapSegs * 2 : 16;
+			HeapSegs = realloc(HeapSegs, MaxHeapSegs * sizeof(SegmentBounds));
+			if (HeapSegs == NULL)
+			{
+				printf("Unable to allocate segment bounds\n");
+				exit(0);
+			}
+		}
+		SegmentBounds *Bounds = &HeapSegs[NumHeapSegs++];
+		Bounds->Seg = L->Segment;
+		Bounds->DataPtr = getDataPtr(L->Segment);
+		Bounds->AllocPtr = getAllocPtr(L->Segment);
+		if (Bounds->DataPtr < HeapLow)
+		{
+			HeapLow = Bounds->DataPtr;
+		}
+		if (Bounds->AllocPtr > HeapHigh)
+		{
+			HeapHigh = Bounds->AllocPtr;
+		}
+	}
+}
+
+/* the snapshot entry whose allocated range contains W, or NULL */
+static SegmentBounds *findHeapSegment(char *W)
+{
+	size_t i;
+	for (i = 0; i < NumHeapSegs; i++)
+	{
+		if (HeapSegs[i].DataPtr <= W && W < HeapSegs[i].AllocPtr)
+		{
+			return &HeapSegs[i];
+		}
+	}
+	return NULL;
+}
+
+/* Retention debugging.
+ * When enabled, every object marked during a collection gets a record of
+ * what marked it first: the root slot (in .data, .bss or on the stack) or the
+ * slot inside the parent object.  Each record also remembers the root its
+ * chain started from, so the bytes kept alive by every root can be totalled.
+ * The records describe the last collection and are rebuilt by the next one.
+ * Only stop-the-world collections record: the marker thread would fill the
+ * table while gc_explain reads it, so no concurrent cycle starts while
+ * retention debugging is on, and one already running records nothing.
+ */
+enum RetainKind
+{
+	RETAIN_DATA,
+	RETAIN_BSS,
+	RETAIN_STACK,
+	RETAIN_REGISTERED,
+	RETAIN_HEAP
+};
+
+static const char *RetainKindNames[] = {"data", "bss", "stack", "registered", "heap"};
+
+typedef struct RetentionRecord
+{
+	ObjHeader *Object;
+	ObjHeader *Parent;
+	char *Slot;
+	char *Root;
+	enum RetainKind RootKind;
+} RetentionRecord;
+
+static int RetentionDebug = 0;
+/* set while a stop-the-world collection with retention debugging runs */
+static int Retaining = 0;
+static RetentionRecord *Retention = NULL;
+static size_t RetentionCapacity = 0;
+static size_t NumRetention = 0;
+
+/* what is being scanned right now: a root range, or the object in Parent */
+static enum RetainKind ScanKind = RETAIN_DATA;
+static RetentionRecord *ScanParent = NULL;
+
+void gc_set_retention_debug(int Enable)
+{
+	RetentionDebug = Enable;
+}
+
+static RetentionRecord *findRetention(ObjHeader *Object)
+{
+	if (RetentionCapacity == 0)
+	{
+		return NULL;
+	}
+	size_t Mask = RetentionCapacity - 1;
+	size_t Idx = hashPointer(Object) & Mask;
+	while (Retention[Idx].Object != NULL)
+	{
+		if (Retention[Idx].Object == Object)
+		{
+			return &Retention[Idx];
+		}
+		Idx = (Idx + 1) & Mask;
+	}
+	return NULL;
+}
+
+static void insertRetention(RetentionRecord *Record)
+{
+	if ((NumRetention + 1) * 4 > RetentionCapacity * 3)
+	{
+		RetentionRecord *Old = Retention;
+		size_t OldCapacity = RetentionCapacity;
+		ObjHeader *Parent = ScanParent ? ScanParent->Object : NULL;
+		size_t i;
+
+		RetentionCapacity = RetentionCapacity ? RetentionCapacity * 2 : 4096;
+		Retention = calloc(RetentionCapacity, sizeof(RetentionRecord));
+		if (Retention == NULL)
+		{
+			printf("Unable to allocate retention records\n");
+			exit(0);
+		}
+		NumRetention = 0;
+		for (i = 0; i < OldCapacity; i++)
+		{
+			if (Old[i].Object != NULL)
+			{
+				insertRetention(&Old[i]);
+			}
+		}
+		free(Old);
+		/* the parent record has moved */
+		if (Parent != NULL)
+		{
+			ScanParent = findRetention(Parent);
+		}
+	}
+	size_t Mask = RetentionCapacity - 1;
+	size_t Idx = hashPointer(Record->Object) & Mask;
+	while (Retention[Idx].Object != NULL)
+	{
+		Idx = (Idx + 1) & Mask;
+	}
+	Retention[Idx] = *Record;
+	NumRetention++;
+}
+
+/* called by markValidObject when Slot makes it mark Object for the first time */
+static void recordRetention(ObjHeader *Object, char *Slot)
+{
+	RetentionRecord Record;
+	Record.Object = Object;
+	Record.Slot = Slot;
+	if (ScanParent != NULL)
+	{
+		Record.Parent = ScanParent->Object;
+		Record.Root = ScanParent->Root;
+		Record.RootKind = ScanParent->RootKind;
+	}
+	else
+	{
+		Record.Parent = NULL;
+		Record.Root = Slot;
+		Record.RootKind = ScanKind;
+	}
+	insertRetention(&Record);
+}
+
+static void clearRetention()
+{
+	if (RetentionCapacity != 0)
+	{
+		memset(Retention, 0, RetentionCapacity * sizeof(RetentionRecord));
+	}
+	NumRetention = 0;
+}
+
+static void printRootSlot(enum RetainKind Kind, char *Slot)
+{
+	Dl_info Info;
+	printf("%s slot %p", RetainKindNames[Kind], Slot);
+	if (Kind != RETAIN_STACK && dladdr(Slot, &Info) && Info.dli_fname != NULL)
+	{
+		if (Info.dli_sname != NULL)
+		{
+			printf(" (%s+0x%lx)", Info.dli_sname, (unsigned long)(Slot - (char *)Info.dli_saddr));
+		}
+		else
+		{
+			const char *Module = strrchr(Info.dli_fname, '/');
+			printf(" (%s+0x%lx)", Module ? Module + 1 : Info.dli_fname,
+				   (unsigned long)(Slot - (char *)Info.dli_fbase));
+		}
+	}
+}
+
+int gc_explain(void *Obj)
+{
+	Segment *Seg = findSegment(Obj);
+	if (Seg == NULL)
+	{
+		printf("%p is not a heap address\n", Obj);
+		return -1;
+	}
+	ObjHeader *Object = (ObjHeader *)retrieveObjectHeader(getBigAlloc(Seg), Obj, Seg);
+	RetentionRecord *Record = Object ? findRetention(Object) : NULL;
+	if (Record == NULL)
+	{
+		printf("%p was not marked by the last collection with retention debugging enabled\n", Obj);
+		return -1;
+	}
+
+	int Length = 0;
+	while (Record != NULL)
+	{
+		printf("object %p (%u bytes) is retained by ", (char *)Record->Object + OBJ_HEADER_SIZE, Record->Object->Size);
+		Length++;
+		if (Record->Parent == NULL)
+		{
+			printRootSlot(Record->RootKind, Record->Slot);
+			printf("\n");
+			break;
+		}
+		printf("offset %ld of object %p\n", (long)(Record->Slot - ((char *)Record->Parent + OBJ_HEADER_SIZE)),
+			   (char *)Record->Parent + OBJ_HEADER_SIZE);
+		Record = findRetention(Record->Parent);
+	}
+	return Length;
+}
+
+typedef struct RetainerTotal
+{
+	char *Root;
+	enum RetainKind Kind;
+	ObjHeader *Target;
+	unsigned long long Bytes;
+	unsigned long long Objects;
+} RetainerTotal;
+
+static int compareRecordsByRoot(const void *A, const void *B)
+{
+	char *X = ((const RetentionRecord *)A)->Root;
+	char *Y = ((const RetentionRecord *)B)->Root;
+	return (X > Y) - (X < Y);
+}
+
+static int compareTotalsByBytes(const void *A, const void *B)
+{
+	unsigned long long X = ((const RetainerTotal *)A)->Bytes;
+	unsigned long long Y = ((const RetainerTotal *)B)->Bytes;
+	return (X < Y) - (X > Y);
+}
+
+void gc_print_top_retainers(int N)
+{
+	RetentionRecord *Records = malloc((NumRetention + 1) * sizeof(RetentionRecord));
+	RetainerTotal *Totals = malloc((NumRetention + 1) * sizeof(RetainerTotal));
+	size_t NumRecords = 0, NumTotals = 0, i;
+
+	if (Records == NULL || Totals == NULL)
+	{
+		free(Records);
+		free(Totals);
+		return;
+	}
+	for (i = 0; i < RetentionCapacity; i++)
+	{
+		if (Retention[i].Object != NULL)
+		{
+			Records[NumRecords++] = Retention[i];
+		}
+	}
+	qsort(Records, NumRecords, sizeof(RetentionRecord), compareRecordsByRoot);
+	for (i = 0; i < NumRecords; i++)
+	{
+		if (NumTotals == 0 || Totals[NumTotals - 1].Root != Records[i].Root)
+		{
+			Totals[NumTotals].Root = Records[i].Root;
+			Totals[NumTotals].Kind = Records[i].RootKind;
+			Totals[NumTotals].Target = NULL;
+			Totals[NumTotals].Bytes = 0;
+			Totals[NumTotals].Objects = 0;
+			NumTotals++;
+		}
+		if (Records[i].Parent == NULL)
+		{
+			Totals[NumTotals - 1].Target = Records[i].Object;
+		}
+		Totals[NumTotals - 1].Bytes += Records[i].Object->Size;
+		Totals[NumTotals - 1].Objects++;
+	}
+	qsort(Totals, NumTotals, sizeof(RetainerTotal), compareTotalsByBytes);
+
+	printf("top retainers of the last collection (%zu roots, %zu marked objects)\n", NumTotals, NumRecords);
+	for (i = 0; i < NumTotals && i < (size_t)N; i++)
+	{
+		printf("%12llu bytes %10llu objects  ", Totals[i].Bytes, Totals[i].Objects);
+		printRootSlot(Totals[i].Kind, Totals[i].Root);
+		printf(" -> object %p\n", (char *)Totals[i].Target + OBJ_HEADER_SIZE);
+	}
+	free(Records);
+	free(Totals);
+}
+
+/* While a cycle is marked concurrently, the marker thread records marks in a
+ * side bitmap per segment, one bit per 8 bytes, instead of setting MARK:
+ * writing the headers would dirty every page holding a live object and leave
+ * the remark to rescan all of them.  The bitmaps are reserved without swap
+ * space, so only the parts covering the heap are ever backed by memory.  The
+ * remark moves the marks into the headers.
+ */
+#define MARK_BITMAP_SIZE (SEGMENT_SIZE / 8 / 8)
+
+static int ConcurrentMarking = 0;
+
+/* give every segment of the heap snapshot a mark bitmap */
+static void prepareMarkBits()
+{
+	size_t i;
+	for (i = 0; i < NumHeapSegs; i++)
+	{
+		Segment *Seg = HeapSegs[i].Seg;
+		if (Seg->Other.MarkBits == NULL)
+		{
+			void *Bits = mmap(NULL, MARK_BITMAP_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+			if (Bits == MAP_FAILED)
+			{
+				printf("unable to allocate a mark bitmap\n");
+				exit(0);
+			}
+			Seg->Other.MarkBits = Bits;
+		}
+	}
+}
+
+/* set the mark bit of Object; returns 0 if it was already set */
+static inline int insertMark(ObjHeader *Object)
+{
+	Segment *Seg = ADDR_TO_SEGMENT(Object);
+	ulong64 Bit = ((char *)Object - (char *)Seg) / 8;
+	ulong64 *Word = &Seg->Other.MarkBits[Bit / 64];
+	ulong64 Mask = 1ULL << (Bit % 64);
+	if (*Word & Mask)
+	{
+		return 0;
+	}
+	*Word |= Mask;
+	return 1;
+}
+
+/* move the marks of a concurrent cycle into the object headers and clear the bitmaps */
+static void applyMarkBits()
+{
+	size_t i;
+	for (i = 0; i < NumHeapSegs; i++)
+	{
+		char *Base = (char *)HeapSegs[i].Seg;
+		ulong64 *Bits = HeapSegs[i].Seg->Other.MarkBits;
+		ulong64 First = (HeapSegs[i].DataPtr - Base) / 8 / 64;
+		ulong64 Last = (HeapSegs[i].AllocPtr - Base + 8 * 64 - 1) / 8 / 64;
+		ulong64 w;
+		for (w = First; w < Last; w++)
+		{
+			ulong64 Word = Bits[w];
+			while (Word)
+			{
+				int Bit = __builtin_ctzll(Word);
+				Word &= Word - 1;
+				((ObjHeader *)(Base + (w * 64 + Bit) * 8))->Status |= MARK;
+			}
+			Bits[w] = 0;
+		}
+	}
+}
+
+/* Evacuation bookkeeping during marking.
+ * When the collection may evacuate, every reference found by a conservative
+ * scan pins its target, and every reference found in a pointer word of a
+ * typed object is recorded as a precise slot so that it can be updated if
+ * its target moves.  Parent is the object holding the slot, which may move
+ * too.
+ */
+typedef struct PreciseSlot
+{
+	char *Slot;
+	ObjHeader *Parent;
+	ObjHeader *Target;
+} PreciseSlot;
+
+static int Evacuating = 0;
+static int ScanPrecise = 0;
+static ObjHeader *ScanObject = NULL;
+static PreciseSlot *PreciseSlots = NULL;
+static size_t NumPreciseSlots = 0;
+static size_t MaxPreciseSlots = 0;
+
+static void recordPreciseSlot(char *Slot, ObjHeader *Target)
+{
+	if (NumPreciseSlots == MaxPreciseSlots)
+	{
+		MaxPreciseSlots = MaxPreciseSlots ? MaxPreciseSlots * 2 : 4096;
+		PreciseSlots = realloc(PreciseSlots, MaxPreciseSlots * sizeof(PreciseSlot));
+		if (PreciseSlots == NULL)
+		{
+			printf("Unable to allocate precise slot list\n");
+			exit(0);
+		}
+	}
+	PreciseSlots[NumPreciseSlots].Slot = Slot;
+	PreciseSlots[NumPreciseSlots].Parent = ScanObject;
+	PreciseSlots[NumPreciseSlots].Target = Target;
+	NumPreciseSlots++;
+}
+
+// markValidObject checks if the 8-byte value W, read from the address pointer, belongs to a heap object.
+// For this, we iterate through the segments and check if the address lies between the data
+// pointer and the alloc pointer of the segment.
+// If it does, we retrive the object header using retrieveObjectHeader and mark the object for scanning.
+static void markValidObject(char *W, char *pointer)
+{
+	// The segment in which the pointer lies, as of the start of the collection.
+	SegmentBounds *Bounds = findHeapSegment(W);
+
+	if (Bounds == NULL)
+	{
+		// Not a valid object.
+		// Does not belong to the heap.
+		return;
+	}
+	Segment *foundSegment = Bounds->Seg;
+	Candidates++;
+
+	// Marking the object for scanning.
+	int isBigAlloc = getBigAlloc(foundSegment);
+	char *objectHeader = retrieveObjectHeader(isBigAlloc, W, foundSegment);
+
+	if (objectHeader == NULL)
+	{
+		// No object header was found.
+		// This means that the object is not a valid object.
+		FalsePointers++;
+		return;
+	}
+
+	// Check if we are supposed to mark the object and add it to the unscanned list.
+	ObjHeader *object = (ObjHeader *)objectHeader;
+	if (Evacuating && (object->Status & FREE) == 0)
+	{
+		if (!ScanPrecise)
+		{
+			object->Status |= PINNED;
+		}
+		else if (!isBigAlloc)
+		{
+			recordPreciseSlot(pointer, object);
+		}
+	}
+	if ((object->Status & (MARK | FREE)) == 0)
+	{
+		if (ConcurrentMarking)
+		{
+			if (!insertMark(object))
+			{
+				return;
+			}
+		}
+		else
+		{
+			object->Status |= MARK;
+		}
+		addToUnscannedList(object);
+		unscannedListCount++;
+		if (Retaining)
+		{
+			recordRetention(object, pointer);
+		}
+	}
+	else if (object->Status & FREE)
+	{
+		// The pointer refers to an object that has already been freed.
+		FalsePointers++;
+	}
+}
+
+/* Candidate pipeline.
+ * Words that pass the heap bounds check wait in a small FIFO before they are
+ * resolved.  Each one has its page metadata and page prefetched when it
+ * enters, so by the time markValidObject walks the segment metadata and the
+ * object headers, those cache lines are usually already on their way.
+ */
+#define PREFETCH_DEPTH 8
+
+static char *CandidateWords[PREFETCH_DEPTH];
+static char *CandidateSlots[PREFETCH_DEPTH];
+static unsigned CandidateHead = 0;
+static unsigned NumCandidates = 0;
+
+static inline int inHeapBounds(char *W)
+{
+	return (ulong64)(W - HeapLow) <= (ulong64)(HeapHigh - HeapLow);
+}
+
+static inline void pushCandidate(char *W, char *Slot)
+{
+	if (NumCandidates == PREFETCH_DEPTH)
+	{
+		markValidObject(CandidateWords[CandidateHead], CandidateSlots[CandidateHead]);
+		NumCandidates--;
+		CandidateHead = (CandidateHead + 1) % PREFETCH_DEPTH;
+	}
+	Segment *Seg = ADDR_TO_SEGMENT(W);
+	__builtin_prefetch(&Seg->Size[(ADDR_TO_PAGE(W) - (char *)Seg) / PAGE_SIZE]);
+	__builtin_prefetch(ADDR_TO_PAGE(W));
+	unsigned Tail = (CandidateHead + NumCandidates) % PREFETCH_DEPTH;
+	CandidateWords[Tail] = W;
+	CandidateSlots[Tail] = Slot;
+	NumCandidates++;
+}
+
+static void drainCandidates()
+{
+	while (NumCandidates > 0)
+	{
+		markValidObject(CandidateWords[CandidateHead], CandidateSlots[CandidateHead]);
+		NumCandidates--;
+		CandidateHead = (CandidateHead + 1) % PREFETCH_DEPTH;
+	}
+}
+
+/* scalar filter over the words starting at every address in [Start, Last] */
+static void filterRangeScalar(char *Start, char *Last)
+{
+	char *pointer;
+	for (pointer = Start; pointer <= Last; pointer++)
+	{
+		char *W = (char *)(*((ulong64 *)pointer));
+		if (inHeapBounds(W))
+		{
+			pushCandidate(W, pointer);
+		}
+	}
+}
+
+/* AVX2 filter: every iteration checks the 32 words starting at P, P+1, ..., P+31.
+ * The load at P+k yields the words at P+k, P+k+8, P+k+16 and P+k+24, so eight
+ * unaligned loads cover all 32 start addresses.  User space addresses are below
+ * 2^63, so signed 64-bit compares are enough for the bounds check.
+ */
+__attribute__((target("avx2"))) static void filterRangeAVX2(char *Start, char *Last)
+{
+	__m256i Low = _mm256_set1_epi64x((long long)HeapLow - 1);
+	__m256i High = _mm256_set1_epi64x((long long)HeapHigh + 1);
+	char *P = Start;
+	int k;
+
+	for (; P + 31 <= Last; P += 32)
+	{
+		unsigned Mask = 0;
+		for (k = 0; k < 8; k++)
+		{
+			__m256i V = _mm256_loadu_si256((const __m256i *)(P + k));
+			__m256i In = _mm256_and_si256(_mm256_cmpgt_epi64(V, Low), _mm256_cmpgt_epi64(High, V));
+			unsigned M = _mm256_movemask_pd(_mm256_castsi256_pd(In));
+			if (M)
+			{
+				/* lane j holds the word at P + k + 8 * j */
+				Mask |= ((M & 1) << k) | (((M >> 1) & 1) << (k + 8)) | (((M >> 2) & 1) << (k + 16)) |
+						(((M >> 3) & 1) << (k + 24));
+			}
+		}
+		while (Mask)
+		{
+			int Bit = __builtin_ctz(Mask);
+			Mask &= Mask - 1;
+			pushCandidate((char *)(*((ulong64 *)(P + Bit))), P + Bit);
+		}
+	}
+	filterRangeScalar(P, Last);
+}
+
+/* mark every object referenced by a word starting in [Start, End-8] */
+static void scanRange(char *Start, char *End)
+{
+	static int UseAVX2 = -1;
+	if (UseAVX2 == -1)
+	{
+		UseAVX2 = __builtin_cpu_supports("avx2");
+	}
+	if (End - Start < 8)
+	{
+		return;
+	}
+	if (UseAVX2)
+	{
+		filterRangeAVX2(Start, End - 8);
+	}
+	else
+	{
+		filterRangeScalar(Start, End - 8);
+	}
+	drainCandidates();
+}
+
+/* set once a typed object has been scanned; evacuation is only worth
+ * attempting in programs that allocate them
+ */
+static int SawTypedObjects = 0;
+
+/* Mark through the pointer words of a typed object.  The layout's bitmap
+ * covers its first Words words and repeats over the rest of the object.
+ */
+static void scanTyped(ObjHeader *Object)
+{
+	ulong64 Layout = Object->Type;
+	unsigned Words = GC_LAYOUT_WORDS(Layout);
+	ulong64 Bitmap = Layout & GC_LAYOUT_BITMAP_MASK;
+	char **Slot = (char **)((char *)Object + OBJ_HEADER_SIZE);
+	char **End = (char **)((char *)Object + Object->Size);
+
+	SawTypedObjects = 1;
+	if (Words == 0)
+	{
+		scanRange((char *)Slot, (char *)End);
+		return;
+	}
+	ScanPrecise = 1;
+	ScanObject = Object;
+	for (; Slot < End; Slot += Words)
+	{
+		ulong64 Bits = Bitmap;
+		while (Bits)
+		{
+			int Word = __builtin_ctzll(Bits);
+			Bits &= Bits - 1;
+			if (Slot + Word >= End)
+			{
+				break;
+			}
+			char *W = Slot[Word];
+			if (inHeapBounds(W))
+			{
+				markValidObject(W, (char *)(Slot + Word));
+			}
+		}
+	}
+	ScanPrecise = 0;
+	ScanObject = NULL;
+}
+
+/* scan objects in the scanner list.
+ * add newly encountered unmarked objects
+ * to the scanner list after marking them.
+ */
+void scanner()
+{
+	// Pop objects off the unscanned list until it is empty.
+	while (NumUnscanned > 0)
+	{
+		ObjHeader *currentObject = Unscanned[--NumUnscanned];
+		if (Retaining)
+		{
+			ScanParent = findRetention(currentObject);
+		}
+		if (currentObject->Status & TYPED)
+		{
+			scanTyped(currentObject);
+			continue;
+		}
+		char *objectStart = (char *)currentObject + OBJ_HEADER_SIZE;
+		/* an arena chunk grows without HeapLock while the marker thread scans it */
+		char *objectEnd = (char *)currentObject + __atomic_load_n(&currentObject->Size, __ATOMIC_ACQUIRE);
+		scanRange(objectStart, objectEnd);
+	}
+	ScanParent = NULL;
+}
+
+static ObjHeader *markOrFreeObject(ObjHeader *currentObjectHeader)
+{
+	ObjHeader *objectToBeFreed = NULL;
+
+	// Set the status of the marked object to 0.
+	if (currentObjectHeader->Status & MARK)
+	{
+		currentObjectHeader->Status &= ~(MARK | PINNED);
+		LiveBytes += currentObjectHeader->Size;
+		LiveObjects++;
+	}
+	// Free the objects that have not been marked.
+	else if ((currentObjectHeader->Status & FREE) == 0)
+	{
+		objectToBeFreed = currentObjectHeader;
+	}
+	return objectToBeFreed;
+}
+
+static void sweepBigAllocation(Segment *curSeg, char *currentPage)
+{
+	char *allocPtr = getAllocPtr(curSeg);
+
+	// The first page of the free span that ends right before currentPage, if any.
+	char *freeSpan = NULL;
+
+	// Walk the segment span by span; every span starts with a Size[] of 1 or PAGE_SIZE.
+	while (currentPage < allocPtr)
+	{
+		unsigned short *sizeMetadata = getSizeMetadata(currentPage);
+		unsigned *spanMetadata = getSpanMetadata(currentPage);
+		unsigned spanPages = spanMetadata[0];
+		assert(sizeMetadata[0] == 1 || sizeMetadata[0] == PAGE_SIZE);
+
+		if (sizeMetadata[0] == 1)
+		{
+			ObjHeader *objectToBeFreed = markOrFreeObject((ObjHeader *)currentPage);
+			if (objectToBeFreed != NULL && (objectToBeFreed->Status & ARENA))
+			{
+				sweepArenaChunk(objectToBeFreed);
+			}
+			else if (objectToBeFreed != NULL)
+			{
+				char *addressToPass = (char *)objectToBeFreed + OBJ_HEADER_SIZE;
+				if ((objectToBeFreed->Status & FORWARDED) == 0)
+				{
+					traceEvent(GC_TRACE_FREE, (unsigned long long)addressToPass, objectToBeFreed->Size);
+				}
+				myfree(addressToPass);
+			}
+		}
+
+		if (sizeMetadata[0] == PAGE_SIZE)
+		{
+			if (freeSpan != NULL)
+			{
+				// Merge into the preceding free span so later sweeps skip both in one step.
+				unsigned *freeSpanMetadata = getSpanMetadata(freeSpan);
+				freeSpanMetadata[0] += spanPages;
+				sizeMetadata[0] = 0;
+				spanMetadata[0] = (currentPage - freeSpan) / PAGE_SIZE;
+			}
+			else
+			{
+				freeSpan = currentPage;
+			}
+		}
+		else
+		{
+			freeSpan = NULL;
+		}
+		currentPage += (ulong64)spanPages * PAGE_SIZE;
+	}
+}
+
+static void traversePageForNormalAllocation(char *currentPage, unsigned short *sizeMetadata, Segment *curSeg)
+{
+	// For this page, we traverse all the objects.
+	char *currentObject = currentPage;
+
+	ObjHeader *objectToFree = NULL;
+
+	// Need to ensure that we are within the boundaries of the page.
+	// Need to ensure that we only free those objects that are unallocated.
+	char *pageBoundary = currentPage + PAGE_SIZE;
+	int withinBoundaries = (currentObject < pageBoundary && currentObject < getAllocPtr(curSeg));
+
+	// Further, we need to ensure that while freeing the objects of a page, we do not try to call
+	// free when the entire page has already been freed.
+	while (sizeMetadata[0] != PAGE_SIZE && withinBoundaries)
+	{
+		ObjHeader *currentObjectHeader = (ObjHeader *)currentObject;
+
+		ObjHeader *objectToFree = markOrFreeObject(currentObjectHeader);
+
+		currentObject = currentObject + currentObjectHeader->Size;
+		currentObjectHeader = (ObjHeader *)currentObject;
+
+		// Free the object if we have found an object to be freed.
+		if (objectToFree != NULL)
+		{
+			char *addressToPass = (char *)objectToFree + OBJ_HEADER_SIZE;
+			if ((objectToFree->Status & FORWARDED) == 0)
+			{
+				traceEvent(GC_TRACE_FREE, (unsigned long long)addressToPass, objectToFree->Size);
+			}
+			myfree(addressToPass);
+		}
+
+		withinBoundaries = (currentObject < pageBoundary && currentObject < getAllocPtr(curSeg));
+	}
+}
+
+static void sweepNormalAllocation(Segment *curSeg, char *currentPage)
+{
+	char *allocPtr = getAllocPtr(curSeg);
+	// Traverse all the pages until the Alloc pointer.
+	for (; currentPage < allocPtr; currentPage += PAGE_SIZE)
+	{
+		unsigned short *sizeMetadata = getSizeMetadata(currentPage);
+
+		// Check if the page is free.
+		int pageIsFree = (sizeMetadata[0] == PAGE_SIZE);
+		if (pageIsFree)
+		{
+			// If the page is free then we move to the next page.
+			continue;
+		}
+
+		traversePageForNormalAllocation(currentPage, sizeMetadata, curSeg);
+	}
+}
+
+/* Free all unmarked objects. */
+static void sweep()
+{
+	// Keeping track of the iterator for the current segment.
+	// This is used to iterate through all the segments.
+	SegmentList *L = Segments;
+
+	// Iterating over all segments.
+	for (; L != NULL; L = L->Next)
+	{
+		Segment *curSeg = L->Segment;
+
+		// We iterate through all the pages of the segment.
+		// We start from the data pointer and iterate through all the pages.
+		char *currentPage = getDataPtr(curSeg);
+
+		// Check if it is a big allocation or not.
+		int isBigAlloc = getBigAlloc(curSeg);
+
+		if (isBigAlloc == 0)
+		{
+			sweepNormalAllocation(curSeg, currentPage);
+		}
+
+		else if (isBigAlloc == 1)
+		{
+			sweepBigAllocation(curSeg, currentPage);
+		}
+	}
+}
+
+/* walk all addresses in the range [Top, Bottom-8].
+ * add unmarked valid objects to the
+ * scanner list after marking them
+ * for scanning.
+ */
+static void scanRoots(unsigned char *Top, unsigned char *Bottom)
+{
+	unscannedListCount = 0;
+	// Walking all the addresses in the range [Top, Bottom-8].
+	// From Lecture - 15:
+	// E.g., if the stack is in the range [x, y] walk all addresses in set S = {x, x+1, x+2,
+	// ..., y-8}
+	scanRange((char *)Top, (char *)Bottom);
+}
+
+static size_t
+getDataSecSz()
+{
+	char Exec[PATH_SZ];
+	static size_t DsecSz = 0;
+
+	if (DsecSz != 0)
+	{
+		return DsecSz;
+	}
+	DsecSz = -1;
+
+	ssize_t Count = readlink("/proc/self/exe", Exec, PATH_SZ);
+
+	if (Count == -1)
+	{
+		return -1;
+	}
+	Exec[Count] = '\0';
+
+	int fd = open(Exec, O_RDONLY);
+	if (fd == -1)
+	{
+		return -1;
+	}
+
+	struct stat Statbuf;
+	fstat(fd, &Statbuf);
+
+	char *Base = mmap(NULL, Statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (Base == NULL)
+	{
+		close(fd);
+		return -1;
+	}
+
+	Elf64_Ehdr *Header = (Elf64_Ehdr *)Base;
+
+	if (Header->e_ident[0] != 0x7f || Header->e_ident[1] != 'E' || Header->e_ident[2] != 'L' || Header->e_ident[3] != 'F')
+	{
+		goto out;
+	}
+
+	int i;
+	Elf64_Shdr *Shdr = (Elf64_Shdr *)(Base + Header->e_shoff);
+	char *Strtab = Base + Shdr[Header->e_shstrndx].sh_offset;
+
+	for (i = 0; i < Header->e_shnum; i++)
+	{
+		char *Name = Strtab + Shdr[i].sh_name;
+		if (!strncmp(Name, ".data", 6))
+		{
+			DsecSz = Shdr[i].sh_size;
+		}
+	}
+
+out:
+	munmap(Base, Statbuf.st_size);
+	close(fd);
+	return DsecSz;
+}
+
+/* close the current phase of a collection and start timing the next one */
+static void endPhase(enum gc_phase Phase)
+{
+	long long Now = getTimeNs();
+	PhaseNs[Phase] = Now - PhaseStartNs;
+	PhaseStartNs = Now;
+}
+
+/* Append one JSON line describing the last collection to the SAFEGC_STATS file. */
+static void writeStatsLine(long long FreedNow)
+{
+	static FILE *StatsFile = NULL;
+	static int StatsFileChecked = 0;
+
+	if (!StatsFileChecked)
+	{
+		StatsFileChecked = 1;
+		char *Path = getenv("SAFEGC_STATS");
+		if (Path != NULL && Path[0] != '\0')
+		{
+			StatsFile = fopen(Path, "a");
+			if (StatsFile == NULL)
+			{
+				printf("unable to open stats file %s\n", Path);
+			}
+		}
+	}
+	if (StatsFile == NULL)
+	{
+		return;
+	}
 
-		while (!(withinObjectBounds == 1) && (withinPageBounds == 1))
+	fprintf(StatsFile,
+			"{\"gc\":%lld,\"pause_ns\":%llu,\"data_roots_ns\":%llu,\"stack_roots_ns\":%llu,"
+			"\"mark_ns\":%llu,\"sweep_ns\":%llu,\"decommit_ns\":%llu,\"remark_ns\":%llu,\"evacuate_ns\":%llu,"
+			"\"concurrent_mark_ns\":%llu,\"dirty_pages\":%llu,\"evacuated_pages\":%llu,\"freed_bytes\":%lld,"
+			"\"live_bytes\":%llu,\"live_objects\":%llu,\"committed_bytes\":%llu,\"reserved_bytes\":%llu,"
+			"\"segments\":%llu,\"candidates\":%llu,\"false_pointers\":%llu}\n",
+			NumGCTriggered, Stats.last_pause_ns, PhaseNs[GC_PHASE_DATA_ROOTS], PhaseNs[GC_PHASE_STACK_ROOTS],
+			PhaseNs[GC_PHASE_MARK], PhaseNs[GC_PHASE_SWEEP], PhaseNs[GC_PHASE_DECOMMIT], PhaseNs[GC_PHASE_REMARK],
+			PhaseNs[GC_PHASE_EVACUATE],
+			Stats.last_concurrent_mark_ns, Stats.last_dirty_pages, Stats.last_evacuated_pages, FreedNow,
+			Stats.live_bytes, Stats.live_objects, Stats.committed_bytes, Stats.reserved_bytes,
+			Stats.segments, Stats.last_candidates, Stats.last_false_pointers);
+	fflush(StatsFile);
+}
+
+/* Count one stop-the-world pause of Pause nanoseconds. */
+static void recordPause(unsigned long long Pause)
+{
+	Stats.total_pause_ns += Pause;
+	if (Pause > Stats.max_pause_ns)
+	{
+		Stats.max_pause_ns = Pause;
+	}
+
+	int Bucket = 0;
+	unsigned long long Micros = Pause / 1000;
+	while (Micros >= 2 && Bucket < GC_PAUSE_HIST_BUCKETS - 1)
+	{
+		Micros >>= 1;
+		Bucket++;
+	}
+	Stats.pause_histogram[Bucket]++;
+}
+
+/* bytes freed before the current collection started */
+static long long CollectionFreedBefore = 0;
+
+/* reset the per-collection counters and take the heap snapshot marking works on */
+static void beginCollection(long long StartNs)
+{
+	CollectionFreedBefore = NumBytesFreed;
+	PhaseStartNs = StartNs;
+	memset(PhaseNs, 0, sizeof(PhaseNs));
+	Candidates = 0;
+	FalsePointers = 0;
+	LiveBytes = 0;
+	LiveObjects = 0;
+	Stats.last_evacuated_pages = 0;
+	clearRetention();
+	computeHeapBounds();
+}
+
+/* Fold the counters of the collection that just finished into Stats.  Pause
+ * is the longest pause it stopped the application for.
+ */
+static void recordCollection(unsigned long long Pause)
+{
+	int Phase;
+
+	NumGCTriggered++;
+	for (Phase = 0; Phase < GC_NUM_PHASES; Phase++)
+	{
+		Stats.last_phase_ns[Phase] = PhaseNs[Phase];
+		Stats.total_phase_ns[Phase] += PhaseNs[Phase];
+	}
+	Stats.last_pause_ns = Pause;
+	Stats.live_bytes = LiveBytes;
+	Stats.live_objects = LiveObjects;
+	Stats.last_candidates = Candidates;
+	Stats.last_false_pointers = FalsePointers;
+	Stats.total_candidates += Candidates;
+	Stats.total_false_pointers += FalsePointers;
+	GCLastPauseNs = Pause;
+
+	traceEvent(GC_TRACE_COLLECT, Pause, NumBytesFreed - CollectionFreedBefore);
+	writeStatsLine(NumBytesFreed - CollectionFreedBefore);
+}
+
+/* Root ranges registered with gc_add_roots, and the ranges gc_exclude_range
+ * takes out of the root scan.  Excluded holds sorted, non-overlapping ranges.
+ */
+typedef struct RootRange
+{
+	char *Start;
+	char *End;
+} RootRange;
+
+static RootRange *ExtraRoots = NULL;
+static size_t NumExtraRoots = 0;
+static size_t MaxExtraRoots = 0;
+
+static RootRange *Excluded = NULL;
+static size_t NumExcluded = 0;
+static size_t MaxExcluded = 0;
+
+static void growRootRanges(RootRange **List, size_t *Max)
+{
+	*Max = *Max ? *Max * 2 : 16;
+	*List = realloc(*List, *Max * sizeof(RootRange));
+	if (*List == NULL)
+	{
+		printf("Unable to allocate root range list\n");
+		exit(0);
+	}
+}
+
+void gc_add_roots(void *Start, void *End)
+{
+	if ((char *)Start >= (char *)End)
+	{
+		return;
+	}
+	pthread_mutex_lock(&HeapLock);
+	if (NumExtraRoots == MaxExtraRoots)
+	{
+		growRootRanges(&ExtraRoots, &MaxExtraRoots);
+	}
+	ExtraRoots[NumExtraRoots].Start = Start;
+	ExtraRoots[NumExtraRoots].End = End;
+	NumExtraRoots++;
+	pthread_mutex_unlock(&HeapLock);
+}
+
+void gc_remove_roots(void *Start, void *End)
+{
+	size_t i, Kept = 0;
+	pthread_mutex_lock(&HeapLock);
+	for (i = 0; i < NumExtraRoots; i++)
+	{
+		if (ExtraRoots[i].Start < (char *)Start || ExtraRoots[i].End > (char *)End)
+		{
+			ExtraRoots[Kept++] = ExtraRoots[i];
+		}
+	}
+	NumExtraRoots = Kept;
+	pthread_mutex_unlock(&HeapLock);
+}
+
+void gc_exclude_range(void *Start, void *End)
+{
+	char *S = Start, *E = End;
+	size_t i, First, Last;
+
+	if (S >= E)
+	{
+		return;
+	}
+	pthread_mutex_lock(&HeapLock);
+	/* ranges in [First, Last) overlap or touch [S, E) and are merged into it */
+	for (First = 0; First < NumExcluded && Excluded[First].End < S; First++)
+		;
+	for (Last = First; Last < NumExcluded && Excluded[Last].Start <= E; Last++)
+	{
+		S = Excluded[Last].Start < S ? Excluded[Last].Start : S;
+		E = Excluded[Last].End > E ? Excluded[Last].End : E;
+	}
+	if (First == Last)
+	{
+		if (NumExcluded == MaxExcluded)
+		{
+			growRootRanges(&Excluded, &MaxExcluded);
+		}
+		memmove(&Excluded[First + 1], &Excluded[First], (NumExcluded - First) * sizeof(RootRange));
+		NumExcluded++;
+	}
+	else
+	{
+		for (i = Last; i < NumExcluded; i++)
+		{
+			Excluded[First + 1 + i - Last] = Excluded[i];
+		}
+		NumExcluded -= Last - First - 1;
+	}
+	Excluded[First].Start = S;
+	Excluded[First].End = E;
+	pthread_mutex_unlock(&HeapLock);
+}
+
+/* scan [Start, End) except the parts inside an excluded range */
+static void scanRootsExcluding(char *Start, char *End)
+{
+	size_t i;
+	for (i = 0; i < NumExcluded && Start < End; i++)
+	{
+		if (Excluded[i].End <= Start)
+		{
+			continue;
+		}
+		if (Excluded[i].Start >= End)
+		{
+			break;
+		}
+		if (Excluded[i].Start > Start)
+		{
+			scanRoots((unsigned char *)Start, (unsigned char *)Excluded[i].Start);
+		}
+		Start = Excluded[i].End;
+	}
+	if (Start < End)
+	{
+		scanRoots((unsigned char *)Start, (unsigned char *)End);
+	}
+}
+
+/* scan .data, .bss and the registered root ranges */
+static void scanDataRoots()
+{
+	size_t DataSecSz = getDataSecSz();
+	unsigned char *DataStart;
+
+	if (DataSecSz == -1)
+	{
+		DataStart = (unsigned char *)&etext;
+	}
+	else
+	{
+		DataStart = (unsigned char *)((char *)&edata - DataSecSz);
+	}
+	unsigned char *DataEnd = (unsigned char *)(&edata);
+
+	/* scan global variables */
+	ScanKind = RETAIN_DATA;
+	scanRootsExcluding((char *)DataStart, (char *)DataEnd);
+
+	unsigned char *UnDataStart = (unsigned char *)(&edata);
+	unsigned char *UnDataEnd = (unsigned char *)(&end);
+
+	/* scan uninitialized global variables */
+	ScanKind = RETAIN_BSS;
+	scanRootsExcluding((char *)UnDataStart, (char *)UnDataEnd);
+
+	/* scan memory the application registered */
+	size_t i;
+	ScanKind = RETAIN_REGISTERED;
+	for (i = 0; i < NumExtraRoots; i++)
+	{
+		scanRootsExcluding(ExtraRoots[i].Start, ExtraRoots[i].End);
+	}
+}
+
+/* Scan the application stack above the frame of the mymalloc or runGC
+ * trampoline; must be called from below that frame.  Returns -1 if the
+ * stack bounds are not known.
+ */
+static int scanStackRoots()
+{
+	int Lvar;
+	void *Base;
+	size_t Size;
+	pthread_attr_t Attr;
+
+	int Ret = pthread_getattr_np(pthread_self(), &Attr);
+	if (Ret != 0)
+	{
+		printf("Error getting stackinfo\n");
+		return -1;
+	}
+	Ret = pthread_attr_getstack(&Attr, &Base, &Size);
+	if (Ret != 0)
+	{
+		printf("Error getting stackinfo\n");
+		return -1;
+	}
+	unsigned char *Bottom = (unsigned char *)(Base + Size);
+	unsigned char *Top = (unsigned char *)&Lvar;
+	/* skip GC stack frame */
+	while (*((unsigned *)Top) != MAGIC_ADDR)
+	{
+		assert(Top < Bottom);
+		Top++;
+	}
+	/* scan application stack */
+	ScanKind = RETAIN_STACK;
+	scanRoots(Top, Bottom);
+	return 0;
+}
+
+/* free unmarked objects, then return the pages that became free to the OS */
+static void sweepHeap()
+{
+	DeferDecommit = 1;
+	sweep();
+	DeferDecommit = 0;
+	ageSamples();
+	endPhase(GC_PHASE_SWEEP);
+
+	decommitPendingPages();
+	if (__atomic_load_n(&MemoryPressure, __ATOMIC_RELAXED) == PRESSURE_HIGH)
+	{
+		releaseLazyPages();
+	}
+	endPhase(GC_PHASE_DECOMMIT);
+}
+
+/* Write tracking for concurrent marking.
+ * The pages that held objects when a cycle started are tracked, and the
+ * remark rescans those the application wrote to while the marker thread was
+ * running.  The kernel's soft-dirty bits are used where they work: writing 4
+ * to /proc/self/clear_refs clears them when the cycle starts, and
+ * /proc/self/pagemap reports them at the remark.  Otherwise the tracked pages
+ * are made read-only, and a SIGSEGV handler records the first write to each
+ * one and makes it writable again.
+ */
+enum DirtyMode
+{
+	DIRTY_UNKNOWN,
+	DIRTY_SOFT_DIRTY,
+	DIRTY_MPROTECT
+};
+
+#define PAGEMAP_SOFT_DIRTY (1ULL << 55)
+
+static enum DirtyMode DirtyTracking = DIRTY_UNKNOWN;
+static int PagemapFd = -1;
+
+/* the tracked pages, sorted by address */
+static PageRange *Tracked = NULL;
+static size_t NumTracked = 0;
+static size_t MaxTracked = 0;
+static size_t NumTrackedPages = 0;
+
+/* pages written to during the cycle; the handler only appends to it */
+static char **DirtyPages = NULL;
+static size_t MaxDirtyPages = 0;
+static size_t NumDirtyPages = 0;
+static volatile sig_atomic_t TrackingWrites = 0;
+static struct sigaction PrevSegvAction;
+
+static void addTrackedRange(char *Start, size_t Size)
+{
+	NumTrackedPages += Size / PAGE_SIZE;
+	appendPageRange(&Tracked, &NumTracked, &MaxTracked, Start, Size);
+}
+
+static int compareRangesByStart(const void *A, const void *B)
+{
+	char *X = ((const PageRange *)A)->Start;
+	char *Y = ((const PageRange *)B)->Start;
+	return X < Y ? -1 : X > Y;
+}
+
+/* collect the pages of the heap snapshot that hold objects */
+static void collectTrackedRanges()
+{
+	size_t i;
+	NumTracked = 0;
+	NumTrackedPages = 0;
+	for (i = 0; i < NumHeapSegs; i++)
+	{
+		Segment *Seg = HeapSegs[i].Seg;
+		char *Page = HeapSegs[i].DataPtr;
+		if (getBigAlloc(Seg))
+		{
+			while (Page < HeapSegs[i].AllocPtr)
+			{
+				size_t SpanSize = (size_t)getSpanMetadata(Page)[0] * PAGE_SIZE;
+				if (getSizeMetadata(Page)[0] == 1 && (((ObjHeader *)Page)->Status & NOSCAN) == 0)
+				{
+					addTrackedRange(Page, SpanSize);
+				}
+				Page += SpanSize;
+			}
+		}
+		else
+		{
+			/* up to the commit pointer, so the page being filled is included */
+			for (; Page < getCommitPtr(Seg); Page += PAGE_SIZE)
+			{
+				if (getSizeMetadata(Page)[0] != PAGE_SIZE)
+				{
+					addTrackedRange(Page, PAGE_SIZE);
+				}
+			}
+		}
+	}
+	qsort(Tracked, NumTracked, sizeof(PageRange), compareRangesByStart);
+}
+
+static int isTrackedAddress(char *Addr)
+{
+	size_t Low = 0;
+	size_t High = NumTracked;
+	while (Low < High)
+	{
+		size_t Mid = (Low + High) / 2;
+		if (Addr < Tracked[Mid].Start)
+		{
+			High = Mid;
+		}
+		else if (Addr >= Tracked[Mid].Start + Tracked[Mid].Size)
+		{
+			Low = Mid + 1;
+		}
+		else
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void writeFaultHandler(int Sig, siginfo_t *Info, void *Context)
+{
+	char *Addr = (char *)Info->si_addr;
+	if (TrackingWrites && isTrackedAddress(Addr))
+	{
+		char *Page = ADDR_TO_PAGE(Addr);
+		size_t Slot = __atomic_fetch_add(&NumDirtyPages, 1, __ATOMIC_RELAXED);
+		if (Slot < MaxDirtyPages)
+		{
+			DirtyPages[Slot] = Page;
+		}
+		mprotect(Page, PAGE_SIZE, PROT_READ | PROT_WRITE);
+		return;
+	}
+	if (PrevSegvAction.sa_flags & SA_SIGINFO)
+	{
+		PrevSegvAction.sa_sigaction(Sig, Info, Context);
+	}
+	else if (PrevSegvAction.sa_handler != SIG_DFL && PrevSegvAction.sa_handler != SIG_IGN)
+	{
+		PrevSegvAction.sa_handler(Sig);
+	}
+	else
+	{
+		/* the faulting access is retried on return and now takes the default action */
+		signal(SIGSEGV, SIG_DFL);
+	}
+}
+
+static int clearSoftDirty()
+{
+	int Fd = open("/proc/self/clear_refs", O_WRONLY);
+	if (Fd == -1)
+	{
+		return -1;
+	}
+	int Ret = write(Fd, "4", 1) == 1 ? 0 : -1;
+	close(Fd);
+	return Ret;
+}
+
+/* Use soft-dirty bits if a page written after clearing them reports one,
+ * and the write fault handler otherwise.
+ */
+static void detectDirtyTracking()
+{
+	DirtyTracking = DIRTY_MPROTECT;
+	PagemapFd = open("/proc/self/pagemap", O_RDONLY);
+	if (PagemapFd != -1)
+	{
+		char *Probe = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+		if (Probe != MAP_FAILED)
+		{
+			ulong64 Entry = 0;
+			Probe[0] = 1;
+			if (clearSoftDirty() == 0)
+			{
+				Probe[0] = 2;
+				if (pread(PagemapFd, &Entry, sizeof(Entry), ((ulong64)Probe / PAGE_SIZE) * sizeof(Entry)) ==
+						sizeof(Entry) &&
+					(Entry & PAGEMAP_SOFT_DIRTY))
+				{
+					DirtyTracking = DIRTY_SOFT_DIRTY;
+				}
+			}
+			munmap(Probe, PAGE_SIZE);
+		}
+	}
+	if (DirtyTracking == DIRTY_SOFT_DIRTY)
+	{
+		return;
+	}
+	if (PagemapFd != -1)
+	{
+		close(PagemapFd);
+		PagemapFd = -1;
+	}
+
+	struct sigaction Action;
+	memset(&Action, 0, sizeof(Action));
+	Action.sa_sigaction = writeFaultHandler;
+	Action.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&Action.sa_mask);
+	if (sigaction(SIGSEGV, &Action, &PrevSegvAction) == -1)
+	{
+		printf("unable to install write fault handler\n");
+		exit(0);
+	}
+}
+
+static void startDirtyTracking()
+{
+	size_t i;
+	collectTrackedRanges();
+	if (NumTrackedPages > MaxDirtyPages)
+	{
+		free(DirtyPages);
+		MaxDirtyPages = NumTrackedPages;
+		DirtyPages = malloc(MaxDirtyPages * sizeof(char *));
+		if (DirtyPages == NULL)
+		{
+			printf("Unable to allocate dirty page list\n");
+			exit(0);
+		}
+	}
+	NumDirtyPages = 0;
+
+	if (DirtyTracking == DIRTY_SOFT_DIRTY)
+	{
+		if (clearSoftDirty() != 0)
+		{
+			printf("unable to clear soft-dirty bits\n");
+			exit(0);
+		}
+		return;
+	}
+	TrackingWrites = 1;
+	for (i = 0; i < NumTracked; i++)
+	{
+		if (mprotect(Tracked[i].Start, Tracked[i].Size, PROT_READ) == -1)
+		{
+			printf("unable to mprotect %s():%d\n", __func__, __LINE__);
+			exit(0);
+		}
+	}
+}
+
+/* add the soft-dirty pages of a tracked range to DirtyPages */
+static void readSoftDirtyPages(PageRange *Range)
+{
+	ulong64 Entries[512];
+	size_t NumPages = Range->Size / PAGE_SIZE;
+	size_t Done = 0;
+
+	while (Done < NumPages)
+	{
+		size_t Count = NumPages - Done < 512 ? NumPages - Done : 512;
+		char *First = Range->Start + Done * PAGE_SIZE;
+		ssize_t Read = pread(PagemapFd, Entries, Count * sizeof(ulong64), ((ulong64)First / PAGE_SIZE) * sizeof(ulong64));
+		size_t i;
+		for (i = 0; i < Count; i++)
+		{
+			if (Read != (ssize_t)(Count * sizeof(ulong64)) || (Entries[i] & PAGEMAP_SOFT_DIRTY))
+			{
+				DirtyPages[NumDirtyPages++] = First + i * PAGE_SIZE;
+			}
+		}
+		Done += Count;
+	}
+}
+
+/* Stop tracking writes and leave the written pages in DirtyPages.  If the
+ * fault handler ran out of room, every tracked page counts as written.
+ */
+static void stopDirtyTracking()
+{
+	size_t i;
+	if (DirtyTracking == DIRTY_SOFT_DIRTY)
+	{
+		for (i = 0; i < NumTracked; i++)
+		{
+			readSoftDirtyPages(&Tracked[i]);
+		}
+		return;
+	}
+	for (i = 0; i < NumTracked; i++)
+	{
+		if (mprotect(Tracked[i].Start, Tracked[i].Size, PROT_READ | PROT_WRITE) == -1)
 		{
-			currentObject = currentObject + currentObjectHeader->Size;
-			currentObjectHeader = (ObjHeader *)currentObject;
-			endAddress = currentObject + currentObjectHeader->Size;
-			startAddress = currentObject + OBJ_HEADER_SIZE;
-			pageBounds = pageForObject + PAGE_SIZE;
+			printf("unable to mprotect %s():%d\n", __func__, __LINE__);
+			exit(0);
+		}
+	}
+	TrackingWrites = 0;
+	if (NumDirtyPages > MaxDirtyPages)
+	{
+		NumDirtyPages = 0;
+		for (i = 0; i < NumTracked; i++)
+		{
+			char *Page;
+			for (Page = Tracked[i].Start; Page < Tracked[i].Start + Tracked[i].Size; Page += PAGE_SIZE)
+			{
+				DirtyPages[NumDirtyPages++] = Page;
+			}
+		}
+	}
+}
 
-			if (W <= endAddress && W >= startAddress)
+/* Rescan what changed on the written pages of the snapshot: marked small
+ * objects on the page are scanned again in full, and a marked big object
+ * only where its words overlap the page.
+ */
+static void rescanDirtyPages()
+{
+	size_t i;
+	ScanKind = RETAIN_HEAP;
+	for (i = 0; i < NumDirtyPages; i++)
+	{
+		char *Page = DirtyPages[i];
+		SegmentBounds *Bounds = findHeapSegment(Page);
+		if (Bounds == NULL || getSizeMetadata(Page)[0] == PAGE_SIZE)
+		{
+			continue;
+		}
+		if (getBigAlloc(Bounds->Seg))
+		{
+			char *First = Page;
+			if (getSizeMetadata(Page)[0] == 0)
 			{
-				withinObjectBounds = 1;
+				First -= (ulong64)getSpanMetadata(Page)[0] * PAGE_SIZE;
 			}
-			else
+			ObjHeader *Object = (ObjHeader *)First;
+			if (getSizeMetadata(First)[0] != 1 || (Object->Status & (MARK | NOSCAN)) != MARK)
 			{
-				withinObjectBounds = 0;
+				continue;
+			}
+			char *Start = Page - 7 > First + OBJ_HEADER_SIZE ? Page - 7 : First + OBJ_HEADER_SIZE;
+			char *ObjectEnd = First + __atomic_load_n(&Object->Size, __ATOMIC_ACQUIRE);
+			char *End = Page + PAGE_SIZE + 7 < ObjectEnd ? Page + PAGE_SIZE + 7 : ObjectEnd;
+			ScanParent = Retaining ? findRetention(Object) : NULL;
+			scanRange(Start, End);
+			ScanParent = NULL;
+		}
+		else
+		{
+			char *Object = Page;
+			while (Object < Page + PAGE_SIZE && Object < Bounds->AllocPtr)
+			{
+				ObjHeader *Header = (ObjHeader *)Object;
+				if (Header->Status & MARK)
+				{
+					addToUnscannedList(Header);
+				}
+				Object += Header->Size;
 			}
+		}
+	}
+	Stats.last_dirty_pages = NumDirtyPages;
+}
 
-			if (W <= pageBounds)
+/* mark and queue for scanning every object allocated in [Start, End) of Seg */
+static void markObjectsInRange(Segment *Seg, char *Start, char *End)
+{
+	while (Start < End)
+	{
+		ObjHeader *Header = (ObjHeader *)Start;
+		if (getBigAlloc(Seg))
+		{
+			if (getSizeMetadata(Start)[0] == 1 && (Header->Status & MARK) == 0)
 			{
-				withinPageBounds = 1;
+				Header->Status |= MARK;
+				addToUnscannedList(Header);
 			}
-			else
+			Start += (ulong64)getSpanMetadata(Start)[0] * PAGE_SIZE;
+		}
+		else
+		{
+			if ((Header->Status & (MARK | FREE)) == 0)
 			{
-				withinPageBounds = 0;
+				Header->Status |= MARK;
+				addToUnscannedList(Header);
 			}
+			Start += Header->Size;
 		}
-		return currentObject;
 	}
-	else
+}
+
+/* Objects allocated during a concurrent cycle survive it: everything past
+ * a segment's snapshot alloc pointer, and all of the segments created since.
+ */
+static void markNewObjects()
+{
+	SegmentList *L;
+	ScanKind = RETAIN_HEAP;
+	for (L = Segments; L != NULL; L = L->Next)
 	{
-		// The object is a big allocation.
-		// We traverse backwards and try to find the first page for this big allocation.
-		for (; foundSegment->Size[pageNoForObject] != 1; pageNoForObject--, pageForObject -= PAGE_SIZE)
-			;
-		return pageForObject;
+		char *Start = getDataPtr(L->Segment);
+		size_t i;
+		for (i = 0; i < NumHeapSegs; i++)
+		{
+			if (HeapSegs[i].Seg == L->Segment)
+			{
+				Start = HeapSegs[i].AllocPtr;
+				break;
+			}
+		}
+		markObjectsInRange(L->Segment, Start, getAllocPtr(L->Segment));
 	}
 }
 
-// markValidObject checks if the 8-byte object at the address belongs to a heap object.
-// For this, we iterate through the segments and check if the address lies between the data
-// pointer and the alloc pointer of the segment.
-// If it does, we retrive the object header using retrieveObjectHeader and mark the object for scanning.
-static void markValidObject(char *pointer)
+/* Concurrent marking.
+ * With concurrent marking enabled, reaching the collection threshold starts
+ * a cycle instead of a full collection: the roots are scanned with the
+ * application stopped, write tracking is armed, and the marker thread marks
+ * the rest of the heap while the application runs.  The first allocation
+ * that takes the slow path after the marker is done finishes the cycle with
+ * a stop-the-world remark, which moves the side marks into the headers, rescans
+ * the roots and the dirtied pages, marks the objects allocated during the
+ * cycle, finishes marking and sweeps.  Free pages found by the sweep, and
+ * pages emptied during the cycle, are only decommitted at its end.
+ */
+enum CycleState
 {
-	// Keeping track of the iterator for the current segment.
-	// This is used to iterate through all the segments.
-	SegmentList *L = Segments;
+	CYCLE_IDLE,
+	CYCLE_MARKING,
+	CYCLE_MARKED
+};
 
-	// The segment in which the pointer lies.
-	Segment *foundSegment = NULL;
+static int ConcurrentMark = 0;
+static int CycleState = CYCLE_IDLE;
+static pthread_mutex_t CycleLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t CycleCond = PTHREAD_COND_INITIALIZER;
+static int MarkerStarted = 0;
+static unsigned long long CycleInitialPauseNs = 0;
+static unsigned long long ConcurrentMarkNs = 0;
 
-	// Extracting the 8-byte value at the address.
-	// Deference the pointer to get the 8-byte value stores at the memory location.
-	// This reinterprets the 8 bytes of the integer as a sequence of 8 characters.
-	// Refer Lect-15 slides.
-	char *W = (char *)(*((ulong64 *)pointer));
+void gc_set_concurrent_mark(int Enable)
+{
+	ConcurrentMark = Enable;
+}
 
-	// Iterating over all the segments to check if the 8-byte values stored at the pointer address
-	// lies between the data pointer and the alloc pointer of the segment.
-	while (L != NULL)
+static void *markerThread(void *Arg)
+{
+	(void)Arg;
+	pthread_mutex_lock(&CycleLock);
+	while (1)
 	{
-		Segment *curSeg = L->Segment;
-		char *dataPtr = getDataPtr(curSeg);
-		char *allocPtr = getAllocPtr(curSeg);
+		while (CycleState != CYCLE_MARKING)
+		{
+			pthread_cond_wait(&CycleCond, &CycleLock);
+		}
+		pthread_mutex_unlock(&CycleLock);
+
+		long long StartNs = getTimeNs();
+		scanner();
+		ConcurrentMarkNs = getTimeNs() - StartNs;
+
+		pthread_mutex_lock(&CycleLock);
+		__atomic_store_n(&CycleState, CYCLE_MARKED, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&CycleCond);
+	}
+	return NULL;
+}
+
+/* returns -1 if the marker thread could not be started */
+static int startMarkerThread()
+{
+	pthread_t Thread;
+	pthread_attr_t Attr;
+
+	if (MarkerStarted)
+	{
+		return 0;
+	}
+	pthread_attr_init(&Attr);
+	pthread_attr_setdetachstate(&Attr, PTHREAD_CREATE_DETACHED);
+	int Ret = pthread_create(&Thread, &Attr, markerThread, NULL);
+	pthread_attr_destroy(&Attr);
+	if (Ret != 0)
+	{
+		printf("unable to start the marker thread\n");
+		return -1;
+	}
+	MarkerStarted = 1;
+	return 0;
+}
+
+/* Start a concurrent cycle.  On the application's thread the roots include
+ * its stack; the idle timer thread starts cycles without it, which is safe
+ * because the remark rescans every root, but leaves more for the remark to mark.
+ * Returns -1 if the marker thread could not be started.
+ */
+static int startConcurrentCycle(int ScanStack)
+{
+	long long StartNs = getTimeNs();
+	if (startMarkerThread() != 0)
+	{
+		return -1;
+	}
+	if (DirtyTracking == DIRTY_UNKNOWN)
+	{
+		detectDirtyTracking();
+	}
+	beginCollection(StartNs);
+	Retaining = 0;
+	DeferDecommit = 1;
+	ConcurrentMarking = 1;
+	prepareMarkBits();
+	startDirtyTracking();
+
+	scanDataRoots();
+	endPhase(GC_PHASE_DATA_ROOTS);
+	CycleInitialPauseNs = 0;
+	if (ScanStack)
+	{
+		scanStackRoots();
+		endPhase(GC_PHASE_STACK_ROOTS);
+		CycleInitialPauseNs = getTimeNs() - StartNs;
+		recordPause(CycleInitialPauseNs);
+	}
+
+	pthread_mutex_lock(&CycleLock);
+	CycleState = CYCLE_MARKING;
+	pthread_cond_broadcast(&CycleCond);
+	pthread_mutex_unlock(&CycleLock);
+	return 0;
+}
+
+static void finishConcurrentCycle()
+{
+	long long StartNs = getTimeNs();
+
+	pthread_mutex_lock(&CycleLock);
+	while (CycleState == CYCLE_MARKING)
+	{
+		pthread_cond_wait(&CycleCond, &CycleLock);
+	}
+	pthread_mutex_unlock(&CycleLock);
+	PhaseStartNs = StartNs;
+
+	stopDirtyTracking();
+	ConcurrentMarking = 0;
+	applyMarkBits();
+	rescanDirtyPages();
+	markNewObjects();
+	computeHeapBounds();
+	scanDataRoots();
+	scanStackRoots();
+	endPhase(GC_PHASE_REMARK);
+
+	scanner();
+	endPhase(GC_PHASE_MARK);
+	sweepHeap();
+
+	unsigned long long RemarkNs = getTimeNs() - StartNs;
+	recordPause(RemarkNs);
+	Stats.concurrent_cycles++;
+	Stats.last_concurrent_mark_ns = ConcurrentMarkNs;
+	Stats.total_concurrent_mark_ns += ConcurrentMarkNs;
+	recordCollection(RemarkNs > CycleInitialPauseNs ? RemarkNs : CycleInitialPauseNs);
+
+	pthread_mutex_lock(&CycleLock);
+	CycleState = CYCLE_IDLE;
+	pthread_mutex_unlock(&CycleLock);
+}
+
+/* Evacuation.
+ * Pages are never reused, so a small-object page whose survivors are few
+ * stays committed until the last of them dies.  Between marking and sweeping,
+ * a stop-the-world collection may copy the survivors of such sparse pages to
+ * the end of the small segment being filled, in the manner of Bartlett's
+ * mostly-copying collector: only objects whose every reference was found in
+ * a pointer word of a typed object can move, since those are the only
+ * references that can be updated.  An object referenced from a root or from
+ * a conservatively scanned object is pinned, and so is every page holding a
+ * pinned or sampled survivor.  Once the copies are made and the precise
+ * slots point at them, the originals are left unmarked, so the sweep frees
+ * them and returns their pages to the OS.  Concurrent cycles never evacuate.
+ */
+#define EVACUATE_MAX_LIVE (PAGE_SIZE / 4)
+#define EVACUATE_MIN_PAGES 8
+
+static int EvacuationEnabled = 1;
+static long long EvacuatedBytes = 0;
+static char **EvacPages = NULL;
+static size_t NumEvacPages = 0;
+static size_t MaxEvacPages = 0;
+
+void gc_set_evacuation(int Enable)
+{
+	pthread_mutex_lock(&HeapLock);
+	EvacuationEnabled = Enable;
+	pthread_mutex_unlock(&HeapLock);
+}
+
+/* returns the bytes marked on Page, or -1 if one of its survivors cannot move */
+static long pageSurvivors(Segment *Seg, char *Page)
+{
+	char *Object = Page;
+	long Live = 0;
+	while (Object < Page + PAGE_SIZE && Object < getAllocPtr(Seg))
+	{
+		ObjHeader *Header = (ObjHeader *)Object;
+		if (Header->Status & MARK)
+		{
+			if (Header->Status & (PINNED | SAMPLED))
+			{
+				return -1;
+			}
+			Live += Header->Size;
+		}
+		Object += Header->Size;
+	}
+	return Live;
+}
 
-		if (dataPtr <= W && W <= allocPtr)
+/* collect the small-object pages that are worth evacuating into EvacPages */
+static void findSparsePages()
+{
+	SegmentList *L;
+	NumEvacPages = 0;
+	for (L = Segments; L != NULL; L = L->Next)
+	{
+		Segment *Seg = L->Segment;
+		if (getBigAlloc(Seg))
+		{
+			continue;
+		}
+		/* the last page may still be being filled */
+		char *Last = ADDR_TO_PAGE(getAllocPtr(Seg));
+		char *Page;
+		for (Page = getDataPtr(Seg); Page < Last; Page += PAGE_SIZE)
 		{
-			foundSegment = curSeg;
+			if (getSizeMetadata(Page)[0] == PAGE_SIZE)
+			{
+				continue;
+			}
+			long Live = pageSurvivors(Seg, Page);
+			if (Live <= 0 || Live > EVACUATE_MAX_LIVE)
+			{
+				continue;
+			}
+			if (NumEvacPages == MaxEvacPages)
+			{
+				MaxEvacPages = MaxEvacPages ? MaxEvacPages * 2 : 256;
+				EvacPages = realloc(EvacPages, MaxEvacPages * sizeof(char *));
+				if (EvacPages == NULL)
+				{
+					printf("Unable to allocate evacuation list\n");
+					exit(0);
+				}
+			}
+			EvacPages[NumEvacPages++] = Page;
+		}
+	}
+}
+
+/* copy the survivors of the sparse pages, then point the precise slots at the copies */
+static void evacuateSparsePages()
+{
+	size_t i, Pages = 0;
 
+	EvacuatedBytes = 0;
+	findSparsePages();
+	if (NumEvacPages < EVACUATE_MIN_PAGES)
+	{
+		return;
+	}
+	for (i = 0; i < NumEvacPages; i++)
+	{
+		char *Page = EvacPages[i];
+		Segment *Seg = ADDR_TO_SEGMENT(Page);
+		char *Object = Page;
+		while (Object < Page + PAGE_SIZE && Object < getAllocPtr(Seg))
+		{
+			ObjHeader *Header = (ObjHeader *)Object;
+			if (Header->Status & MARK)
+			{
+				/* the originals are only freed by the sweep, so the copies must fit under the limit now */
+				if (HardLimit != 0 &&
+					Stats.committed_bytes + heapGrowth(Header->Size - OBJ_HEADER_SIZE, Header->Size) > HardLimit)
+				{
+					break;
+				}
+				char *Copy = allocateSmall(Header->Size);
+				if (Copy == NULL)
+				{
+					/* the rest stays where it is */
+					break;
+				}
+				memcpy(Copy, Header, Header->Size);
+				Header->Status = FORWARDED;
+				Header->Type = (ulong64)Copy;
+				EvacuatedBytes += Header->Size;
+				traceEvent(GC_TRACE_MOVE, (unsigned long long)Object + OBJ_HEADER_SIZE,
+						   (unsigned long long)Copy + OBJ_HEADER_SIZE);
+			}
+			Object += Header->Size;
+		}
+		if (Object < Page + PAGE_SIZE && Object < getAllocPtr(Seg))
+		{
 			break;
 		}
-		L = L->Next;
+		Pages++;
 	}
 
-	if (foundSegment == NULL)
+	for (i = 0; i < NumPreciseSlots; i++)
 	{
-		// Not a valid object.
-		// Does not belong to the heap.
+		PreciseSlot *Ref = &PreciseSlots[i];
+		char *Slot = Ref->Slot;
+		if (Ref->Parent != NULL && (Ref->Parent->Status & FORWARDED))
+		{
+			Slot = (char *)Ref->Parent->Type + (Slot - (char *)Ref->Parent);
+		}
+		if (Ref->Target->Status & FORWARDED)
+		{
+			char **Word = (char **)Slot;
+			*Word = (char *)Ref->Target->Type + (*Word - (char *)Ref->Target);
+		}
+	}
+	Stats.last_evacuated_pages = Pages;
+	Stats.total_evacuated_bytes += EvacuatedBytes;
+}
+
+/* LastFullPauseNs is the pause of the last stop-the-world collection, when
+ * LastFullCommitted bytes were committed; gc_collect_if_idle scales it to
+ * predict the next one.
+ */
+static unsigned long long LastFullPauseNs = 0;
+static unsigned long long LastFullCommitted = 0;
+
+static void collectGarbage()
+{
+	retractAllocState();
+	if (__atomic_load_n(&CycleState, __ATOMIC_ACQUIRE) != CYCLE_IDLE)
+	{
+		finishConcurrentCycle();
+		publishAllocState();
 		return;
 	}
 
-	// Marking the object for scanning.
-	int isBigAlloc = getBigAlloc(foundSegment);
-	char *objectHeader = retrieveObjectHeader(isBigAlloc, W, foundSegment);
+	long long StartNs = getTimeNs();
+	beginCollection(StartNs);
+	Retaining = RetentionDebug;
+	/* moved objects would leave stale addresses in the retention records */
+	Evacuating = EvacuationEnabled && SawTypedObjects && !Retaining;
+	NumPreciseSlots = 0;
 
-	if (objectHeader == NULL)
+	scanDataRoots();
+	endPhase(GC_PHASE_DATA_ROOTS);
+
+	if (scanStackRoots() != 0)
 	{
-		// No object header was found.
-		// This means that the object is not a valid object.
+		Evacuating = 0;
 		return;
 	}
+	endPhase(GC_PHASE_STACK_ROOTS);
 
-	// Check if we are supposed to mark the object and add it to the unscanned list.
-	ObjHeader *object = (ObjHeader *)objectHeader;
-	if (object->Status == 0)
+	scanner();
+	endPhase(GC_PHASE_MARK);
+
+	if (Evacuating)
 	{
-		object->Status = MARK;
-		addToUnscannedList(object);
-		unscannedListCount++;
+		evacuateSparsePages();
+		Evacuating = 0;
+		endPhase(GC_PHASE_EVACUATE);
+	}
+	sweepHeap();
+	/* the sweep counted the evacuated originals as freed, but their copies live on */
+	NumBytesFreed -= EvacuatedBytes;
+	EvacuatedBytes = 0;
+
+	Stats.last_concurrent_mark_ns = 0;
+	Stats.last_dirty_pages = 0;
+	unsigned long long Pause = getTimeNs() - StartNs;
+	recordPause(Pause);
+	recordCollection(Pause);
+	LastFullPauseNs = Pause;
+	LastFullCommitted = Stats.committed_bytes + (NumBytesFreed - CollectionFreedBefore);
+	publishAllocState();
+}
+
+/* Free everything that is unreachable now.  A concurrent cycle keeps what
+ * was allocated while it marked, so one in flight is finished first and a
+ * stop-the-world collection follows it.
+ */
+static void collectAllGarbage()
+{
+	if (__atomic_load_n(&CycleState, __ATOMIC_ACQUIRE) != CYCLE_IDLE)
+	{
+		retractAllocState();
+		finishConcurrentCycle();
+	}
+	collectGarbage();
+}
+
+void _runGC()
+{
+	pthread_mutex_lock(&HeapLock);
+	collectAllGarbage();
+	pthread_mutex_unlock(&HeapLock);
+}
+
+/* Idle collection.
+ * gc_collect_if_idle runs on the application's thread, through its own
+ * trampoline so that the stack can be scanned like in runGC.  It finishes a
+ * concurrent cycle whose marking is done, or starts a collection once at
+ * least an eighth of the trigger has been allocated since the last one: a
+ * concurrent cycle if concurrent marking is on, otherwise a full collection
+ * if its predicted pause fits the budget.  The idle timer thread instead
+ * acts after a quiet period without allocation.  It cannot scan the
+ * application's stack, so the only collections it starts are concurrent
+ * cycles, whose remark rescans the stack.  Both return lazily freed pages
+ * to the OS.
+ */
+#define IDLE_MIN_ALLOC_FRACTION 8
+/* assumed collection cost before the first full collection has been timed */
+#define IDLE_NS_PER_COMMITTED_BYTE 8
+
+static unsigned IdleQuietMs = 0;
+static pthread_t IdleThread;
+static int IdleThreadRunning = 0;
+static int IdleThreadStop = 0;
+
+static unsigned long long predictPauseNs()
+{
+	if (LastFullPauseNs == 0 || LastFullCommitted == 0)
+	{
+		return Stats.committed_bytes * IDLE_NS_PER_COMMITTED_BYTE;
+	}
+	return (double)LastFullPauseNs * Stats.committed_bytes / LastFullCommitted;
+}
+
+/* Do the collection work the application is idle for; called with HeapLock
+ * held.  Returns 1 if a collection was started or finished.
+ */
+static int idleWork(unsigned long long BudgetNs, int OnAppThread)
+{
+	int State = __atomic_load_n(&CycleState, __ATOMIC_ACQUIRE);
+	int Ret = 0;
+
+	if (State == CYCLE_MARKED && OnAppThread)
+	{
+		finishConcurrentCycle();
+		Ret = 1;
+	}
+	else if (State == CYCLE_IDLE && AllocSinceGC >= gcTrigger() / IDLE_MIN_ALLOC_FRACTION)
+	{
+		if (ConcurrentMark && !RetentionDebug && startConcurrentCycle(OnAppThread) == 0)
+		{
+			AllocSinceGC = 0;
+			Ret = 1;
+		}
+		else if (OnAppThread && predictPauseNs() <= BudgetNs)
+		{
+			AllocSinceGC = 0;
+			collectGarbage();
+			Ret = 1;
+		}
+	}
+	releaseLazyPages();
+	return Ret;
+}
+
+int _gc_collect_if_idle(unsigned BudgetUs)
+{
+	pthread_mutex_lock(&HeapLock);
+	retractAllocState();
+	int Ret = idleWork((unsigned long long)BudgetUs * 1000, 1);
+	publishAllocState();
+	pthread_mutex_unlock(&HeapLock);
+	return Ret;
+}
+
+/* Changes whenever the application allocates.  Read without HeapLock, so a
+ * stale value only makes the timer wait one more period.
+ */
+static ulong64 allocationSignature()
+{
+	return (ulong64)__atomic_load_n(&NumBytesAllocated, __ATOMIC_RELAXED) ^
+		   (ulong64)__atomic_load_n(&gc_alloc_state.alloc_ptr, __ATOMIC_RELAXED);
+}
+
+static void *idleThread(void *Arg)
+{
+	(void)Arg;
+	ulong64 Signature = allocationSignature();
+	long long QuietSince = getTimeNs();
+	int Done = 0;
+	unsigned SleepMs = IdleQuietMs / 4 ? IdleQuietMs / 4 : 1;
+
+	while (!__atomic_load_n(&IdleThreadStop, __ATOMIC_RELAXED))
+	{
+		usleep(SleepMs * 1000);
+		ulong64 Now = allocationSignature();
+		if (Now != Signature)
+		{
+			Signature = Now;
+			QuietSince = getTimeNs();
+			Done = 0;
+			continue;
+		}
+		if (!Done && getTimeNs() - QuietSince >= (long long)IdleQuietMs * 1000000)
+		{
+			pthread_mutex_lock(&HeapLock);
+			idleWork(0, 0);
+			pthread_mutex_unlock(&HeapLock);
+			Done = 1;
+		}
+	}
+	return NULL;
+}
+
+void gc_set_idle_timer(unsigned QuietMs)
+{
+	if (IdleThreadRunning)
+	{
+		__atomic_store_n(&IdleThreadStop, 1, __ATOMIC_RELAXED);
+		pthread_join(IdleThread, NULL);
+		IdleThreadRunning = 0;
+	}
+	IdleQuietMs = QuietMs;
+	if (QuietMs == 0)
+	{
+		return;
+	}
+	IdleThreadStop = 0;
+	if (pthread_create(&IdleThread, NULL, idleThread, NULL) != 0)
+	{
+		printf("unable to start the idle timer\n");
+		return;
+	}
+	IdleThreadRunning = 1;
+}
+
+
+/* Memory pressure monitor.
+ * A background thread polls the cgroup's memory.current and memory.max and
+ * the PSI memory.pressure file, and rates memory as plentiful, normal or
+ * under pressure.  The allocator acts on the rating at its next slow-path
+ * allocation.  Under pressure, the collection trigger drops to a quarter of
+ * GC_THRESHOLD, a collection runs right away, and every collection drops
+ * the pages released lazily before.  When memory is plentiful, the trigger
+ * rises to four times GC_THRESHOLD and free pages are released with
+ * MADV_FREE, which leaves the kernel to take them back when it needs them.
+ */
+#define PRESSURE_HIGH_USAGE 0.90
+#define PRESSURE_LOW_USAGE 0.50
+/* share of the last 10 seconds some task stalled on memory, in percent */
+#define PRESSURE_HIGH_STALL 10.0
+#define PRESSURE_LOW_STALL 1.0
+#define MONITOR_INTERVAL_MS 100
+
+static char MonitorCurrentPath[PATH_MAX];
+static char MonitorMaxPath[PATH_MAX];
+static char MonitorPressurePath[PATH_MAX];
+static unsigned MonitorIntervalMs = MONITOR_INTERVAL_MS;
+static pthread_t MonitorThread;
+static int MonitorRunning = 0;
+static int MonitorStop = 0;
+static int CollectRequested = 0;
+
+/* read a memory.current or memory.max value; "max" reads as ULLONG_MAX */
+static int readMemoryCounter(const char *Path, ulong64 *Value)
+{
+	char Buf[64];
+	FILE *File = fopen(Path, "r");
+	if (File == NULL)
+	{
+		return -1;
+	}
+	int Ret = fgets(Buf, sizeof(Buf), File) != NULL ? 0 : -1;
+	fclose(File);
+	if (Ret == 0)
+	{
+		*Value = strncmp(Buf, "max", 3) == 0 ? ULLONG_MAX : strtoull(Buf, NULL, 10);
 	}
+	return Ret;
 }
 
-/* scan objects in the scanner list.
- * add newly encountered unmarked objects
- * to the scanner list after marking them.
- */
-void scanner()
+/* read avg10 of the "some" line of a PSI file */
+static int readMemoryStall(const char *Path, double *Avg10)
 {
-	// Traverse Unscanned List.
-	UnscannedListNode *currentNode = Unscanned->Head;
-	int count = 0;
-	// Print the number of objects in the unscanned list.
-	// Traverse scanner list and count.
-	UnscannedListNode *temp = Unscanned->Head;
-	while (temp != NULL)
+	char Buf[256];
+	int Ret = -1;
+	FILE *File = fopen(Path, "r");
+	if (File == NULL)
 	{
-		count++;
-		temp = temp->Next;
+		return -1;
 	}
-	printf("Number of objects in the unscanned list: %d\n", count);
-	while (currentNode != NULL)
+	while (fgets(Buf, sizeof(Buf), File) != NULL)
 	{
-		ObjHeader *currentObject = currentNode->Object;
-		char *objectStart = (char *)currentObject + OBJ_HEADER_SIZE;
-		char *objectEnd = (char *)currentObject + currentObject->Size;
-		for (char *pointer = objectStart; pointer <= objectEnd - 8; pointer++)
+		if (sscanf(Buf, "some avg10=%lf", Avg10) == 1)
 		{
-			markValidObject(pointer);
+			Ret = 0;
+			break;
 		}
-		// Remove currentNode from the list and move to the next node for traversal.
-		Unscanned->Head = Unscanned->Head->Next;
-		currentNode = currentNode->Next;
 	}
+	fclose(File);
+	return Ret;
+}
+
+/* returns -1 if none of the monitored files can be read */
+static int ratePressure(int *Level)
+{
+	ulong64 Current, Max;
+	double Stall;
+	int HaveUsage = readMemoryCounter(MonitorCurrentPath, &Current) == 0 &&
+					readMemoryCounter(MonitorMaxPath, &Max) == 0 && Max != ULLONG_MAX && Max != 0;
+	int HaveStall = readMemoryStall(MonitorPressurePath, &Stall) == 0;
+	double Usage = HaveUsage ? (double)Current / Max : 0;
 
-	if (Unscanned->Head == NULL)
+	if (!HaveUsage && !HaveStall)
 	{
-		Unscanned->Head = NULL;
-		Unscanned->Tail = NULL;
+		return -1;
 	}
-
-	count = 0;
-	// Print the number of objects in the unscanned list.
-	// Traverse scanner list and count.
-	temp = Unscanned->Head;
-	while (temp != NULL)
+	if ((HaveUsage && Usage >= PRESSURE_HIGH_USAGE) || (HaveStall && Stall >= PRESSURE_HIGH_STALL))
 	{
-		count++;
-		temp = temp->Next;
+		*Level = PRESSURE_HIGH;
 	}
-	printf("Number of objects in the unscanned list: %d\n", count);
-}
-
-static ObjHeader *markOrFreeObject(ObjHeader *currentObjectHeader)
-{
-	ObjHeader *objectToBeFreed = NULL;
-
-	// Set the status of the marked object to 0.
-	if (currentObjectHeader->Status == MARK)
+	else if ((!HaveUsage || Usage < PRESSURE_LOW_USAGE) && (!HaveStall || Stall < PRESSURE_LOW_STALL))
 	{
-		currentObjectHeader->Status = 0;
+		*Level = PRESSURE_LOW;
 	}
-	// Free the objects that have not been marked.
-	else if (currentObjectHeader->Status == 0)
+	else
 	{
-		objectToBeFreed = currentObjectHeader;
+		*Level = PRESSURE_NORMAL;
 	}
-	return objectToBeFreed;
+	return 0;
 }
 
-static void sweepBigAllocation(Segment *curSeg, char *currentPage)
+static void *monitorThread(void *Arg)
 {
-	char *allocPtr = getAllocPtr(curSeg);
-	for (; currentPage < allocPtr; currentPage += PAGE_SIZE)
+	(void)Arg;
+	while (!__atomic_load_n(&MonitorStop, __ATOMIC_RELAXED))
 	{
-		unsigned short *sizeMetadata = getSizeMetadata(currentPage);
-
-		// Check if the page is free.
-		int pageIsFree = (sizeMetadata[0] == PAGE_SIZE);
-		if (pageIsFree)
+		int Level;
+		if (ratePressure(&Level) == 0)
 		{
-			// If the page is free then we move to the next page.
-			continue;
-		}
-
-		int headerForBigAlloc = (sizeMetadata[0] == 1);
-		char *currentObject = currentPage;
-		ObjHeader *currentObjectHeader = (ObjHeader *)currentObject;
-		unsigned sizeToBeFreed = currentObjectHeader->Size;
-
-		// Need to check if this page hold the object header for the big allocation.
-		if (headerForBigAlloc)
-		{
-
-			ObjHeader *objectToBeFreed = markOrFreeObject(currentObjectHeader);
-			if (objectToBeFreed != NULL)
+			int Old = __atomic_exchange_n(&MemoryPressure, Level, __ATOMIC_RELAXED);
+			if (Level == PRESSURE_HIGH && Old != PRESSURE_HIGH)
 			{
-				char *addressToPass = (char *)objectToBeFreed + OBJ_HEADER_SIZE;
-				myfree(addressToPass);
+				__atomic_store_n(&CollectRequested, 1, __ATOMIC_RELAXED);
 			}
-
-			currentPage += sizeToBeFreed;
 		}
+		usleep(MonitorIntervalMs * 1000);
 	}
+	return NULL;
 }
 
-static void traversePageForNormalAllocation(char *currentPage, unsigned short *sizeMetadata, Segment *curSeg)
+/* Store the cgroup v2 directory of the process, or SAFEGC_CGROUP_DIR if set,
+ * in Dir; Dir is left as it is if the process has no cgroup v2 entry.
+ * Returns -1 if the path does not fit in Size bytes.
+ */
+static int findCgroupDir(char *Dir, size_t Size)
 {
-	// For this page, we traverse all the objects.
-	char *currentObject = currentPage;
-
-	ObjHeader *objectToFree = NULL;
-
-	// Need to ensure that we are within the boundaries of the page.
-	// Need to ensure that we only free those objects that are unallocated.
-	char *pageBoundary = currentPage + PAGE_SIZE;
-	int withinBoundaries = (currentObject < pageBoundary && currentObject < getAllocPtr(curSeg));
-
-	// Further, we need to ensure that while freeing the objects of a page, we do not try to call
-	// free when the entire page has already been freed.
-	while (sizeMetadata[0] != PAGE_SIZE && withinBoundaries)
+	char Line[PATH_MAX];
+	char *Override = getenv("SAFEGC_CGROUP_DIR");
+	if (Override != NULL)
 	{
-		ObjHeader *currentObjectHeader = (ObjHeader *)currentObject;
-
-		ObjHeader *objectToFree = markOrFreeObject(currentObjectHeader);
-
-		currentObject = currentObject + currentObjectHeader->Size;
-		currentObjectHeader = (ObjHeader *)currentObject;
-
-		// Free the object if we have found an object to be freed.
-		if (objectToFree != NULL)
-		{
-			char *addressToPass = (char *)objectToFree + OBJ_HEADER_SIZE;
-			myfree(addressToPass);
-		}
-
-		withinBoundaries = (currentObject < pageBoundary && currentObject < getAllocPtr(curSeg));
+		return snprintf(Dir, Size, "%s", Override) < (int)Size ? 0 : -1;
 	}
-}
-
-static void sweepNormalAllocation(Segment *curSeg, char *currentPage)
-{
-	char *allocPtr = getAllocPtr(curSeg);
-	// Traverse all the pages until the Alloc pointer.
-	for (; currentPage < allocPtr; currentPage += PAGE_SIZE)
+	FILE *File = fopen("/proc/self/cgroup", "r");
+	if (File == NULL)
 	{
-		unsigned short *sizeMetadata = getSizeMetadata(currentPage);
-
-		// Check if the page is free.
-		int pageIsFree = (sizeMetadata[0] == PAGE_SIZE);
-		if (pageIsFree)
+		return 0;
+	}
+	int Ret = 0;
+	while (fgets(Line, sizeof(Line), File) != NULL)
+	{
+		if (strncmp(Line, "0::", 3) == 0)
 		{
-			// If the page is free then we move to the next page.
-			continue;
+			Line[strcspn(Line, "\n")] = '\0';
+			Ret = snprintf(Dir, Size, "/sys/fs/cgroup%s", Line + 3) < (int)Size ? 0 : -1;
+			break;
 		}
-
-		traversePageForNormalAllocation(currentPage, sizeMetadata, curSeg);
 	}
+	fclose(File);
+	return Ret;
 }
 
-/* Free all unmarked objects. */
-static void sweep()
+int gc_start_memory_monitor(const struct gc_memory_monitor_config *Config)
 {
-	// Keeping track of the iterator for the current segment.
-	// This is used to iterate through all the segments.
-	SegmentList *L = Segments;
+	char Dir[PATH_MAX] = "/sys/fs/cgroup";
+	struct gc_memory_monitor_config Defaults = {NULL, NULL, NULL, 0};
+	int Level;
 
-	// Iterating over all segments.
-	for (; L != NULL; L = L->Next)
+	if (MonitorRunning)
 	{
-		Segment *curSeg = L->Segment;
-
-		// We iterate through all the pages of the segment.
-		// We start from the data pointer and iterate through all the pages.
-		char *currentPage = getDataPtr(curSeg);
-
-		// Check if it is a big allocation or not.
-		int isBigAlloc = getBigAlloc(curSeg);
-
-		if (isBigAlloc == 0)
-		{
-			sweepNormalAllocation(curSeg, currentPage);
-		}
+		return 0;
+	}
+	if (Config == NULL)
+	{
+		Config = &Defaults;
+	}
+	/* a truncated path could name some other file */
+	if (findCgroupDir(Dir, sizeof(Dir)) != 0 ||
+		snprintf(MonitorCurrentPath, PATH_MAX, "%s/memory.current", Dir) >= PATH_MAX ||
+		snprintf(MonitorMaxPath, PATH_MAX, "%s/memory.max", Dir) >= PATH_MAX ||
+		snprintf(MonitorPressurePath, PATH_MAX, "%s/memory.pressure", Dir) >= PATH_MAX)
+	{
+		printf("the cgroup directory path is too long\n");
+		return -1;
+	}
+	if (access(MonitorPressurePath, R_OK) != 0)
+	{
+		/* without a cgroup file, use the system-wide pressure */
+		snprintf(MonitorPressurePath, PATH_MAX, "/proc/pressure/memory");
+	}
+	if ((Config->current_path != NULL &&
+		 snprintf(MonitorCurrentPath, PATH_MAX, "%s", Config->current_path) >= PATH_MAX) ||
+		(Config->max_path != NULL && snprintf(MonitorMaxPath, PATH_MAX, "%s", Config->max_path) >= PATH_MAX) ||
+		(Config->pressure_path != NULL &&
+		 snprintf(MonitorPressurePath, PATH_MAX, "%s", Config->pressure_path) >= PATH_MAX))
+	{
+		printf("a memory monitor path is too long\n");
+		return -1;
+	}
+	MonitorIntervalMs = Config->interval_ms ? Config->interval_ms : MONITOR_INTERVAL_MS;
 
-		else if (isBigAlloc == 1)
-		{
-			sweepBigAllocation(curSeg, currentPage);
-		}
+	if (ratePressure(&Level) != 0)
+	{
+		printf("unable to read the cgroup memory files\n");
+		return -1;
+	}
+	MonitorStop = 0;
+	if (pthread_create(&MonitorThread, NULL, monitorThread, NULL) != 0)
+	{
+		printf("unable to start the memory monitor\n");
+		return -1;
 	}
+	MonitorRunning = 1;
+	return 0;
 }
 
-/* walk all addresses in the range [Top, Bottom-8].
- * add unmarked valid objects to the
- * scanner list after marking them
- * for scanning.
- */
-static void scanRoots(unsigned char *Top, unsigned char *Bottom)
+void gc_stop_memory_monitor()
 {
-	char *pointer;
-	unscannedListCount = 0;
-	// Walking all the addresses in the range [Top, Bottom-8].
-	// From Lecture - 15:
-	// E.g., if the stack is in the range [x, y] walk all addresses in set S = {x, x+1, x+2,
-	// ..., y-8}
-	for (pointer = Top; (char *)pointer <= (char *)Bottom - 8; (char *)pointer++)
+	if (!MonitorRunning)
 	{
-		markValidObject(pointer);
+		return;
 	}
+	__atomic_store_n(&MonitorStop, 1, __ATOMIC_RELAXED);
+	pthread_join(MonitorThread, NULL);
+	MonitorRunning = 0;
+	__atomic_store_n(&MemoryPressure, PRESSURE_NORMAL, __ATOMIC_RELAXED);
+	__atomic_store_n(&CollectRequested, 0, __ATOMIC_RELAXED);
 }
 
-static size_t
-getDataSecSz()
+int gc_trace_start(const char *Path)
 {
-	char Exec[PATH_SZ];
-	static size_t DsecSz = 0;
+	static int StopAtExit = 0;
+	struct gc_trace_header Header;
 
-	if (DsecSz != 0)
+	pthread_mutex_lock(&HeapLock);
+	if (TraceFd >= 0)
 	{
-		return DsecSz;
+		pthread_mutex_unlock(&HeapLock);
+		return -1;
 	}
-	DsecSz = -1;
-
-	ssize_t Count = readlink("/proc/self/exe", Exec, PATH_SZ);
-
-	if (Count == -1)
+	if (TraceBuf == NULL)
 	{
-		return -1;
+		TraceBuf = malloc(TRACE_BUF_RECORDS * sizeof(struct gc_trace_record));
+		if (TraceBuf == NULL)
+		{
+			printf("Unable to allocate trace buffer\n");
+			exit(0);
+		}
 	}
-	Exec[Count] = '\0';
-
-	int fd = open(Exec, O_RDONLY);
-	if (fd == -1)
+	int Fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (Fd < 0)
 	{
+		printf("unable to open trace file %s\n", Path);
+		pthread_mutex_unlock(&HeapLock);
 		return -1;
 	}
-
-	struct stat Statbuf;
-	fstat(fd, &Statbuf);
-
-	char *Base = mmap(NULL, Statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
-	if (Base == NULL)
+	memset(&Header, 0, sizeof(Header));
+	memcpy(Header.magic, GC_TRACE_MAGIC, sizeof(Header.magic));
+	Header.version = GC_TRACE_VERSION;
+	Header.record_size = sizeof(struct gc_trace_record);
+	if (write(Fd, &Header, sizeof(Header)) != sizeof(Header))
 	{
-		close(fd);
+		printf("unable to write trace file %s\n", Path);
+		close(Fd);
+		pthread_mutex_unlock(&HeapLock);
 		return -1;
 	}
+	/* take back the fast path's budget so that it traces nothing */
+	retractAllocState();
+	TraceFd = Fd;
+	TraceStartNs = getTimeNs();
+	NumTraceRecords = 0;
+	publishAllocState();
+	pthread_mutex_unlock(&HeapLock);
 
-	Elf64_Ehdr *Header = (Elf64_Ehdr *)Base;
-
-	if (Header->e_ident[0] != 0x7f || Header->e_ident[1] != 'E' || Header->e_ident[2] != 'L' || Header->e_ident[3] != 'F')
+	if (!StopAtExit)
 	{
-		goto out;
+		StopAtExit = 1;
+		atexit(gc_trace_stop);
 	}
+	return 0;
+}
 
-	int i;
-	Elf64_Shdr *Shdr = (Elf64_Shdr *)(Base + Header->e_shoff);
-	char *Strtab = Base + Shdr[Header->e_shstrndx].sh_offset;
-
-	for (i = 0; i < Header->e_shnum; i++)
+void gc_trace_stop()
+{
+	pthread_mutex_lock(&HeapLock);
+	if (TraceFd >= 0)
 	{
-		char *Name = Strtab + Shdr[i].sh_name;
-		if (!strncmp(Name, ".data", 6))
-		{
-			DsecSz = Shdr[i].sh_size;
-		}
+		flushTrace();
+		close(TraceFd);
+		TraceFd = -1;
+		retractAllocState();
+		publishAllocState();
 	}
-
-out:
-	munmap(Base, Statbuf.st_size);
-	close(fd);
-	return DsecSz;
+	pthread_mutex_unlock(&HeapLock);
 }
 
-void _runGC()
+/* parse a byte count with an optional K, M or G suffix */
+static size_t parseSize(const char *Str)
 {
-	NumGCTriggered++;
-
-	size_t DataSecSz = getDataSecSz();
-	unsigned char *DataStart;
+	char *Suffix;
+	size_t Size = strtoull(Str, &Suffix, 0);
+	switch (*Suffix)
+	{
+	case 'g':
+	case 'G':
+		Size <<= 10;
+		/* fall through */
+	case 'm':
+	case 'M':
+		Size <<= 10;
+		/* fall through */
+	case 'k':
+	case 'K':
+		Size <<= 10;
+	}
+	return Size;
+}
 
-	if (DataSecSz == -1)
+/* read the collector's settings from the environment when the library is loaded */
+__attribute__((constructor)) static void initFromEnvironment()
+{
+	char *Rate = getenv("SAFEGC_PROFILE_RATE");
+	if (Rate != NULL)
 	{
-		DataStart = (unsigned char *)&etext;
+		gc_set_profile_rate(strtoull(Rate, NULL, 0));
 	}
-	else
+	char *Retention = getenv("SAFEGC_RETENTION");
+	if (Retention != NULL)
 	{
-		DataStart = (unsigned char *)((char *)&edata - DataSecSz);
+		gc_set_retention_debug(atoi(Retention));
 	}
-	unsigned char *DataEnd = (unsigned char *)(&edata);
-
-	/* scan global variables */
-	scanRoots(DataStart, DataEnd);
-
-	unsigned char *UnDataStart = (unsigned char *)(&edata);
-	unsigned char *UnDataEnd = (unsigned char *)(&end);
-
-	/* scan uninitialized global variables */
-	scanRoots(UnDataStart, UnDataEnd);
-
-	int Lvar;
-	void *Base;
-	size_t Size;
-	pthread_attr_t Attr;
-
-	int Ret = pthread_getattr_np(pthread_self(), &Attr);
-	if (Ret != 0)
+	char *Concurrent = getenv("SAFEGC_CONCURRENT");
+	if (Concurrent != NULL)
 	{
-		printf("Error getting stackinfo\n");
-		return;
+		gc_set_concurrent_mark(atoi(Concurrent));
 	}
-	Ret = pthread_attr_getstack(&Attr, &Base, &Size);
-	if (Ret != 0)
+	char *SoftLimitStr = getenv("SAFEGC_HEAP_SOFT_LIMIT");
+	char *HardLimitStr = getenv("SAFEGC_HEAP_HARD_LIMIT");
+	if (SoftLimitStr != NULL || HardLimitStr != NULL)
 	{
-		printf("Error getting stackinfo\n");
-		return;
+		gc_set_heap_limits(SoftLimitStr ? parseSize(SoftLimitStr) : 0, HardLimitStr ? parseSize(HardLimitStr) : 0);
 	}
-	unsigned char *Bottom = (unsigned char *)(Base + Size);
-	unsigned char *Top = (unsigned char *)&Lvar;
-	/* skip GC stack frame */
-	while (*((unsigned *)Top) != MAGIC_ADDR)
+	char *IdleMs = getenv("SAFEGC_IDLE_MS");
+	if (IdleMs != NULL)
 	{
-		assert(Top < Bottom);
-		Top++;
+		gc_set_idle_timer(atoi(IdleMs));
+	}
+	char *Trace = getenv("SAFEGC_TRACE");
+	if (Trace != NULL && Trace[0] != '\0')
+	{
+		gc_trace_start(Trace);
+	}
+	char *Evacuate = getenv("SAFEGC_EVACUATE");
+	if (Evacuate != NULL)
+	{
+		gc_set_evacuation(atoi(Evacuate));
+	}
+	char *Monitor = getenv("SAFEGC_MEMORY_MONITOR");
+	if (Monitor != NULL && atoi(Monitor))
+	{
+		gc_start_memory_monitor(NULL);
 	}
-	/* scan application stack */
-	scanRoots(Top, Bottom);
-
-	scanner();
-	sweep();
 }
 
 static void checkAndRunGC(size_t Sz)
 {
-	static size_t TotalAlloc = 0;
-
-	TotalAlloc += Sz;
-	if (TotalAlloc < GC_THRESHOLD)
+	AllocSinceGC += Sz;
+	/* the first slow-path allocation after concurrent marking is done finishes the cycle */
+	if (__atomic_load_n(&CycleState, __ATOMIC_ACQUIRE) == CYCLE_MARKED)
+	{
+		finishConcurrentCycle();
+	}
+	/* the monitor saw memory pressure set in */
+	if (__atomic_exchange_n(&CollectRequested, 0, __ATOMIC_RELAXED))
+	{
+		AllocSinceGC = 0;
+		Stats.pressure_collections++;
+		collectAllGarbage();
+		return;
+	}
+	if (AllocSinceGC < gcTrigger())
+	{
+		return;
+	}
+	AllocSinceGC = 0;
+	if (ConcurrentMark && !RetentionDebug && CycleState == CYCLE_IDLE && startConcurrentCycle(1) == 0)
 	{
 		return;
 	}
-	TotalAlloc = 0;
-	_runGC();
+	collectGarbage();
+}
+
+void gc_get_stats(struct gc_stats *Out)
+{
+	pthread_mutex_lock(&HeapLock);
+	retractAllocState();
+	*Out = Stats;
+	Out->collections = NumGCTriggered;
+	Out->bytes_allocated = NumBytesAllocated;
+	Out->bytes_freed = NumBytesFreed;
+	pthread_mutex_unlock(&HeapLock);
 }
 
 void printMemoryStats()
 {
+	pthread_mutex_lock(&HeapLock);
+	retractAllocState();
 	printf("Num Bytes Allocated: %lld\n", NumBytesAllocated);
 	printf("Num Bytes Freed: %lld\n", NumBytesFreed);
 	printf("Num GC Triggered: %lld\n", NumGCTriggered);
+	pthread_mutex_unlock(&HeapLock);
 }
 
 // Size -> Array -> stores info for every page
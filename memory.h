@@ -3,8 +3,343 @@
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* phases of a collection, used to index the per-phase timings in gc_stats */
+enum gc_phase
+{
+	GC_PHASE_DATA_ROOTS,  /* scanning .data and .bss */
+	GC_PHASE_STACK_ROOTS, /* scanning the application stack */
+	GC_PHASE_MARK,		  /* transitive marking through the unscanned list */
+	GC_PHASE_SWEEP,		  /* freeing unmarked objects */
+	GC_PHASE_DECOMMIT,	  /* returning free pages to the OS */
+	GC_PHASE_REMARK,	  /* rescanning roots and dirtied pages after concurrent marking */
+	GC_PHASE_EVACUATE,	  /* copying survivors out of sparse pages */
+	GC_NUM_PHASES
+};
+
+/* bucket i counts pauses in [2^i, 2^(i+1)) microseconds; bucket 0 also counts
+ * pauses under a microsecond and the last bucket is open-ended */
+#define GC_PAUSE_HIST_BUCKETS 24
+
+struct gc_stats
+{
+	unsigned long long collections;
+	unsigned long long bytes_allocated;
+	unsigned long long bytes_freed;
+
+	unsigned long long last_phase_ns[GC_NUM_PHASES];
+	unsigned long long total_phase_ns[GC_NUM_PHASES];
+	unsigned long long last_pause_ns;
+	unsigned long long total_pause_ns;
+	unsigned long long max_pause_ns;
+	unsigned long long pause_histogram[GC_PAUSE_HIST_BUCKETS];
+
+	/* heap state after the last collection */
+	unsigned long long live_bytes;
+	unsigned long long live_objects;
+	unsigned long long committed_bytes;
+	unsigned long long reserved_bytes;
+	unsigned long long segments;
+
+	/* words that looked like heap addresses, and those that did not hit an allocated object */
+	unsigned long long last_candidates;
+	unsigned long long last_false_pointers;
+	unsigned long long total_candidates;
+	unsigned long long total_false_pointers;
+
+	/* concurrent cycles finished, time the marker thread spent marking, and
+	 * pages the application wrote to during the last cycle */
+	unsigned long long concurrent_cycles;
+	unsigned long long last_concurrent_mark_ns;
+	unsigned long long total_concurrent_mark_ns;
+	unsigned long long last_dirty_pages;
+
+	/* collections started because the memory monitor saw pressure */
+	unsigned long long pressure_collections;
+
+	/* sparse pages emptied by the last collection's evacuation, and bytes copied by all of them */
+	unsigned long long last_evacuated_pages;
+	unsigned long long total_evacuated_bytes;
+};
+
+/* output formats of gc_heap_profile_dump */
+enum gc_profile_format
+{
+	GC_PROFILE_FOLDED, /* one "frame;frame;... bytes" line per site, for flame graphs */
+	GC_PROFILE_PPROF,  /* legacy gperftools heap profile, readable by pprof */
+	GC_PROFILE_CENSUS  /* live heap by size class and by allocation site */
+};
+
 void *mymalloc(size_t Size);
+/* like mymalloc, for objects that hold no pointers: the collector never scans them */
+void *mymalloc_atomic(size_t Size);
+
+/* Layout of a typed object.  Bit i of the bitmap is set if word i of the
+ * object holds a pointer; the pattern covers the first `words` words and
+ * repeats over the rest of the object, so one layout also describes an
+ * array of structs.  Only the pointer words are scanned, and they are
+ * precise: each must hold NULL, a pointer outside the heap or a pointer into
+ * a live heap object, never other data.  An object referred to only from
+ * such words may be moved to compact sparse pages, and the words are
+ * updated to point at its new address.
+ *
+ * words must be between 1 and GC_LAYOUT_MAX_WORDS; 0 makes the whole object
+ * scanned conservatively, as if it were untyped.  Anything larger does not
+ * fit in the layout, and mymalloc_typed rejects it.
+ */
+typedef unsigned long long gc_layout;
+#define GC_LAYOUT_MAX_WORDS 58
+#define GC_LAYOUT_BITMAP_MASK ((1ULL << GC_LAYOUT_MAX_WORDS) - 1)
+/* a period too long for the bitmap becomes the invalid 63 instead of wrapping around */
+#define GC_LAYOUT(words, bitmap)                                                                   \
+	(((gc_layout)((words) > GC_LAYOUT_MAX_WORDS ? 63 : (words)) << GC_LAYOUT_MAX_WORDS) |          \
+	 ((gc_layout)(bitmap)&GC_LAYOUT_BITMAP_MASK))
+#define GC_LAYOUT_WORDS(layout) ((unsigned)((layout) >> GC_LAYOUT_MAX_WORDS))
+
+/* like mymalloc, for an object with the given layout */
+void *mymalloc_typed(size_t Size, gc_layout Layout);
 void printMemoryStats();
 void runGC();
 
+/* Allocation state shared with the inline fast path in gc_malloc.  alloc_ptr
+ * and limit bound the free part of the page currently being filled, and
+ * budget is how many bytes may still be allocated inline before the library
+ * has to see an allocation (to start a collection, take a profiler sample,
+ * and so on).  The library refreshes it whenever mymalloc is entered.
+ */
+struct gc_alloc_state
+{
+	char *alloc_ptr;
+	char *limit;
+	long long budget;
+};
+
+extern struct gc_alloc_state gc_alloc_state;
+
+/* the object header written by gc_malloc; mirrors ObjHeader in memory.c */
+struct gc_object_header
+{
+	unsigned size;
+	unsigned status;
+	unsigned long long type;
+};
+
+/* status bits of objects allocated with mymalloc_atomic or gc_malloc_atomic,
+ * and with mymalloc_typed or gc_malloc_typed
+ */
+#define GC_OBJECT_NOSCAN 16
+#define GC_OBJECT_TYPED 32
+
+/* bump-allocate Size bytes in the current page with the given header status
+ * and type, or return NULL if the allocation has to take the slow path
+ */
+static inline void *gc_bump_alloc(size_t Size, unsigned Status, unsigned long long Type)
+{
+	size_t AlignedSize = ((Size + 7) & ~(size_t)7) + sizeof(struct gc_object_header);
+	char *Ptr = gc_alloc_state.alloc_ptr;
+	if (__builtin_expect(Size != 0 && AlignedSize <= (size_t)(gc_alloc_state.limit - Ptr) &&
+							 (long long)AlignedSize <= gc_alloc_state.budget,
+						 1))
+	{
+		struct gc_object_header *Header = (struct gc_object_header *)Ptr;
+		gc_alloc_state.alloc_ptr = Ptr + AlignedSize;
+		gc_alloc_state.budget -= AlignedSize;
+		Header->size = AlignedSize;
+		Header->status = Status;
+		Header->type = Type;
+		return Header + 1;
+	}
+	return NULL;
+}
+
+/* Allocate like mymalloc, but bump-allocate inline when the object fits in the
+ * current page and no collection is due.  Only the slow path goes through the
+ * register-spilling mymalloc trampoline, which is the only path that can collect.
+ */
+static inline void *gc_malloc(size_t Size)
+{
+	void *Ptr = gc_bump_alloc(Size, 0, 0);
+	return __builtin_expect(Ptr != NULL, 1) ? Ptr : mymalloc(Size);
+}
+
+/* gc_malloc for objects that hold no pointers */
+static inline void *gc_malloc_atomic(size_t Size)
+{
+	void *Ptr = gc_bump_alloc(Size, GC_OBJECT_NOSCAN, 0);
+	return __builtin_expect(Ptr != NULL, 1) ? Ptr : mymalloc_atomic(Size);
+}
+
+/* gc_malloc for objects with a layout */
+static inline void *gc_malloc_typed(size_t Size, gc_layout Layout)
+{
+	/* an invalid layout takes the slow path, which rejects it */
+	void *Ptr = GC_LAYOUT_WORDS(Layout) <= GC_LAYOUT_MAX_WORDS ? gc_bump_alloc(Size, GC_OBJECT_TYPED, Layout) : NULL;
+	return __builtin_expect(Ptr != NULL, 1) ? Ptr : mymalloc_typed(Size, Layout);
+}
+
+/* copy the collector statistics into Stats */
+void gc_get_stats(struct gc_stats *Stats);
+
+/* Sample on average one allocation every mean_bytes allocated bytes and record
+ * its stack trace; 0 disables sampling.  SAFEGC_PROFILE_RATE sets it at startup.
+ */
+void gc_set_profile_rate(size_t mean_bytes);
+
+/* write the sampled live heap to path; returns 0 on success and -1 on error */
+int gc_heap_profile_dump(const char *path, enum gc_profile_format format);
+
+/* Record which root or parent object first marked each object during a
+ * collection; SAFEGC_RETENTION=1 enables it at startup.
+ */
+void gc_set_retention_debug(int enable);
+
+/* print the chain of slots that kept obj alive in the last collection back to
+ * its root; returns the length of the chain or -1 if obj was not recorded
+ */
+int gc_explain(void *obj);
+
+/* print the n roots whose marked subgraphs held the most bytes in the last collection */
+void gc_print_top_retainers(int n);
+
+/* Mark the heap on a background thread: a collection stops the application
+ * only to scan the roots and, once marking is done, for a remark and the
+ * sweep.  SAFEGC_CONCURRENT=1 enables it at startup.
+ */
+void gc_set_concurrent_mark(int enable);
+
+/* Scan [start, end) for pointers on every collection, like .data and .bss.
+ * Use it for memory the collector does not know about, such as mmap'd regions
+ * or malloc'ed structures, that holds pointers into the heap.
+ */
+void gc_add_roots(void *start, void *end);
+
+/* unregister every root range that lies inside [start, end) */
+void gc_remove_roots(void *start, void *end);
+
+/* Never scan [start, end) for roots, for large globals such as lookup tables
+ * and I/O buffers that hold no heap pointers.  Applies to .data, .bss and the
+ * registered root ranges; the stack is always scanned.
+ */
+void gc_exclude_range(void *start, void *end);
+
+/* Let stop-the-world collections move typed-referenced objects out of
+ * sparsely occupied pages (on by default); SAFEGC_EVACUATE=0 disables it at
+ * startup.  It only starts once a typed object has been seen, and never runs
+ * with retention debugging or in concurrent cycles.
+ */
+void gc_set_evacuation(int enable);
+
+/* Limit the committed heap, metadata included; 0 means no limit.  Growing
+ * past soft first runs a full collection; growing past hard fails the
+ * allocation.  SAFEGC_HEAP_SOFT_LIMIT and SAFEGC_HEAP_HARD_LIMIT set them at
+ * startup and take K, M and G suffixes.
+ */
+void gc_set_heap_limits(size_t soft, size_t hard);
+
+/* called with the requested size when an allocation fails; mymalloc returns
+ * its result.  Without a handler mymalloc returns NULL.
+ */
+typedef void *(*gc_oom_handler)(size_t size);
+void gc_set_oom_handler(gc_oom_handler handler);
+
+/* files read by the memory monitor; NULL members use the defaults */
+struct gc_memory_monitor_config
+{
+	const char *current_path;  /* cgroup memory.current */
+	const char *max_path;	   /* cgroup memory.max */
+	const char *pressure_path; /* PSI memory.pressure */
+	unsigned interval_ms;	   /* polling interval, 100 if 0 */
+};
+
+/* Start a thread that watches the cgroup's memory usage and PSI stalls and
+ * adapts collection to them: under pressure it collects sooner and releases
+ * memory eagerly, and when memory is plentiful it collects less often.  The
+ * default files are those of the process's cgroup v2 directory (or of
+ * SAFEGC_CGROUP_DIR), with /proc/pressure/memory standing in for a missing
+ * memory.pressure.  config may be NULL.  Returns 0 on success and -1 if none
+ * of the files can be read.  SAFEGC_MEMORY_MONITOR=1 starts it at startup.
+ */
+int gc_start_memory_monitor(const struct gc_memory_monitor_config *config);
+void gc_stop_memory_monitor(void);
+
+/* Tell the collector the application expects to be idle for about budget_us
+ * microseconds.  If enough has been allocated since the last collection, it
+ * collects now: a full collection if its predicted pause fits the budget, or
+ * the start of a concurrent cycle with concurrent marking on.  A concurrent
+ * cycle whose marking is done is finished.  Returns 1 if a collection was
+ * started or finished, 0 otherwise.
+ */
+int gc_collect_if_idle(unsigned budget_us);
+
+/* Start a timer thread that acts once no allocation has happened for
+ * quiet_ms milliseconds: it returns lazily freed pages to the OS and, with
+ * concurrent marking on, starts a concurrent cycle.  0 stops it.
+ * SAFEGC_IDLE_MS sets it at startup.
+ */
+void gc_set_idle_timer(unsigned quiet_ms);
+
+/* An arena allocates objects that all die together.  Its objects are packed
+ * into chunks of whole pages without headers; while any of them is referenced
+ * the collector keeps and scans all of its chunks as a unit, and the sweep
+ * never frees them one by one.  gc_arena_release returns every chunk to the
+ * heap at once, so the application must no longer use any of its objects.
+ * Chunks of an arena whose objects are all unreachable are freed by the sweep
+ * even without gc_arena_release, and the arena then starts over empty; only
+ * the gc_arena itself needs the release.
+ * chunk_size is rounded up to whole pages, and 0 means 64K.
+ */
+typedef struct gc_arena gc_arena;
+
+gc_arena *gc_arena_create(size_t chunk_size);
+/* may collect like mymalloc; returns NULL (or the out-of-memory handler's result) on failure */
+void *gc_arena_alloc(gc_arena *arena, size_t size);
+void gc_arena_release(gc_arena *arena);
+
+/* A trace file is a gc_trace_header followed by gc_trace_records, in the
+ * order the events happened.
+ */
+#define GC_TRACE_MAGIC "SGCTRACE"
+#define GC_TRACE_VERSION 1
+
+struct gc_trace_header
+{
+	char magic[8]; /* GC_TRACE_MAGIC, without the terminating NUL */
+	unsigned version;
+	unsigned record_size; /* sizeof(struct gc_trace_record) */
+};
+
+enum gc_trace_kind
+{
+	GC_TRACE_ALLOC,	  /* addr and requested size of an allocation */
+	GC_TRACE_FREE,	  /* addr and size, header included, of an object the sweep freed */
+	GC_TRACE_COLLECT, /* a finished collection: addr is its pause in ns, size the bytes it freed */
+	GC_TRACE_MOVE,	  /* an object evacuated from addr; size is its new address */
+};
+
+struct gc_trace_record
+{
+	unsigned long long time_ns; /* since the trace was started */
+	unsigned long long addr;
+	unsigned long long size;
+	unsigned thread; /* kernel thread id */
+	unsigned kind;	 /* enum gc_trace_kind */
+};
+
+/* Record allocations, frees and collections to a trace file at path, for
+ * replaying with safegc-replay.  gc_malloc takes the mymalloc path while a
+ * trace is recorded.  Returns 0 on success and -1 if the file cannot be
+ * written or a trace is already being recorded.  SAFEGC_TRACE=path starts
+ * one at startup; the trace is flushed at exit.
+ */
+int gc_trace_start(const char *path);
+void gc_trace_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
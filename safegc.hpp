@@ -0,0 +1,174 @@
+#ifndef _SAFEGC_HPP_
+#define _SAFEGC_HPP_
+
+/* C++ layer over the collector.
+ *
+ * safegc::allocator<T> lets standard containers keep their storage in the
+ * collected heap, and safegc::make<T>(args...) constructs a T there.  Both
+ * allocate types that cannot hold pointers with gc_malloc_atomic, so the
+ * collector never scans them; everything else is scanned conservatively as
+ * before.  The collector frees unreachable storage without running
+ * destructors, so deallocate is a no-op and objects made with make<T> must
+ * not own resources outside the heap.
+ */
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "memory.h"
+
+namespace safegc
+{
+
+/* True if a T can never hold a heap pointer.  Arithmetic and enum types and
+ * arrays of them qualify; specialize it for your own pointer-free types.
+ */
+template <class T>
+struct is_pointer_free : std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_enum<T>::value>
+{
+};
+
+template <class T>
+struct is_pointer_free<const T> : is_pointer_free<T>
+{
+};
+
+template <class T, std::size_t N>
+struct is_pointer_free<T[N]> : is_pointer_free<T>
+{
+};
+
+template <class T>
+constexpr bool is_pointer_free_v = is_pointer_free<T>::value;
+
+/* allocate Size bytes, tagged as never scanned when PointerFree; throws std::bad_alloc */
+template <bool PointerFree>
+inline void *allocate_bytes(std::size_t Size)
+{
+	if (Size == 0)
+	{
+		Size = 1;
+	}
+	void *Ptr = PointerFree ? gc_malloc_atomic(Size) : gc_malloc(Size);
+	if (Ptr == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return Ptr;
+}
+
+template <class T>
+class allocator
+{
+public:
+	using value_type = T;
+	using is_always_equal = std::true_type;
+
+	allocator() noexcept = default;
+
+	template <class U>
+	allocator(const allocator<U> &) noexcept
+	{
+	}
+
+	T *allocate(std::size_t N)
+	{
+		static_assert(alignof(T) <= 8, "the collected heap only aligns objects to 8 bytes");
+		if (N > std::numeric_limits<std::size_t>::max() / sizeof(T))
+		{
+			throw std::bad_array_new_length();
+		}
+		return static_cast<T *>(allocate_bytes<is_pointer_free_v<T>>(N * sizeof(T)));
+	}
+
+	/* the collector reclaims the storage once it is unreachable */
+	void deallocate(T *, std::size_t) noexcept
+	{
+	}
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept
+{
+	return true;
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept
+{
+	return false;
+}
+
+/* A pointer to an object in the collected heap.  It is a plain pointer
+ * underneath, so the collector finds it wherever it is stored; the type only
+ * records that the object is owned by the collector and must not be deleted.
+ */
+template <class T>
+class ptr
+{
+public:
+	ptr() noexcept : Ptr(nullptr)
+	{
+	}
+
+	ptr(std::nullptr_t) noexcept : Ptr(nullptr)
+	{
+	}
+
+	explicit ptr(T *Ptr) noexcept : Ptr(Ptr)
+	{
+	}
+
+	template <class U, class = typename std::enable_if<std::is_convertible<U *, T *>::value>::type>
+	ptr(const ptr<U> &Other) noexcept : Ptr(Other.get())
+	{
+	}
+
+	T *get() const noexcept
+	{
+		return Ptr;
+	}
+
+	T &operator*() const noexcept
+	{
+		return *Ptr;
+	}
+
+	T *operator->() const noexcept
+	{
+		return Ptr;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return Ptr != nullptr;
+	}
+
+	friend bool operator==(const ptr &A, const ptr &B) noexcept
+	{
+		return A.Ptr == B.Ptr;
+	}
+
+	friend bool operator!=(const ptr &A, const ptr &B) noexcept
+	{
+		return A.Ptr != B.Ptr;
+	}
+
+private:
+	T *Ptr;
+};
+
+/* construct a T in the collected heap */
+template <class T, class... Args>
+ptr<T> make(Args &&...args)
+{
+	static_assert(alignof(T) <= 8, "the collected heap only aligns objects to 8 bytes");
+	void *Mem = allocate_bytes<is_pointer_free_v<T>>(sizeof(T));
+	return ptr<T>(new (Mem) T(std::forward<Args>(args)...));
+}
+
+} // namespace safegc
+
+#endif